@@ -0,0 +1,37 @@
+#include "arena.hpp"
+
+namespace adl {
+
+Arena::Arena() : current_(nullptr), memory_usage_(0) {
+  lock_guard<mutex> lock(mu_);
+  current_.store(NewBlock(block_size_), memory_order_release);
+}
+
+char *Arena::Allocate(size_t bytes) {
+  bytes = (bytes + align_ - 1) & ~(align_ - 1);
+  /* 大块单独分配，避免浪费当前块剩下的空间 */
+  if (bytes > block_size_ / 4) {
+    lock_guard<mutex> lock(mu_);
+    return NewBlock(bytes)->data.get();
+  }
+
+  while (true) {
+    Block *block = current_.load(memory_order_acquire);
+    size_t offset = block->used.fetch_add(bytes, memory_order_relaxed);
+    if (offset + bytes <= block->size) return block->data.get() + offset;
+
+    /* 当前块用完了，只有第一个发现的线程负责换上新块 */
+    lock_guard<mutex> lock(mu_);
+    if (current_.load(memory_order_relaxed) == block)
+      current_.store(NewBlock(block_size_), memory_order_release);
+  }
+}
+
+/* 需要持有 mu_ */
+Arena::Block *Arena::NewBlock(size_t size) {
+  blocks_.push_back(make_unique<Block>(size));
+  memory_usage_.fetch_add(size + sizeof(Block), memory_order_relaxed);
+  return blocks_.back().get();
+}
+
+}  // namespace adl
@@ -0,0 +1,55 @@
+#ifndef ADL_LSM_TREE_ARENA_H__
+#define ADL_LSM_TREE_ARENA_H__
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace adl {
+
+using namespace std;
+
+/**
+ * @brief 内存池，为 memtable 分配 key/value 和跳表节点。
+ *
+ * 分配只是在当前块上原子地推进偏移量，多个线程可以并发分配；
+ * 只有当前块用完需要换新块时才会加锁。内存只会在 Arena 析构时统一释放。
+ */
+class Arena {
+ public:
+  Arena();
+  Arena(const Arena &) = delete;
+  Arena &operator=(const Arena &) = delete;
+  ~Arena() = default;
+
+  /* 返回的内存按指针大小对齐 */
+  char *Allocate(size_t bytes);
+  /* 已经向系统申请的内存总量 */
+  size_t MemoryUsage() const {
+    return memory_usage_.load(memory_order_relaxed);
+  }
+
+ private:
+  struct Block {
+    explicit Block(size_t size) : used(0), size(size), data(new char[size]) {}
+    std::atomic<size_t> used;
+    size_t size;
+    unique_ptr<char[]> data;
+  };
+
+  Block *NewBlock(size_t size);
+
+  static constexpr size_t block_size_ = 1UL << 16; /* 64KB */
+  static constexpr size_t align_ = sizeof(void *);
+
+  std::atomic<Block *> current_;
+  /* 只保护 blocks_ */
+  mutex mu_;
+  vector<unique_ptr<Block>> blocks_;
+  std::atomic<size_t> memory_usage_;
+};
+
+}  // namespace adl
+#endif  // ADL_LSM_TREE_ARENA_H__
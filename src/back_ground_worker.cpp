@@ -1,53 +1,131 @@
 #include "back_ground_worker.hpp"
+#ifdef __linux__
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 //#include <fmt/format.h>
 
 namespace adl {
 
-Worker *Worker::NewBackgroundWorker() {
-  auto worker = new Worker;
-  worker->thread_ = new std::thread([](Worker *w) { w->Run(); }, worker);
-  return worker;
+namespace {
+/* 当前线程所属的线程池和它在池中的编号 */
+thread_local const void *current_pool = nullptr;
+thread_local int current_index = -1;
+}  // namespace
+
+ThreadPool::ThreadPool(int threads_number, bool low_priority)
+    : next_queue_(0), pending_(0), closed_(false) {
+  for (int i = 0; i < threads_number; i++)
+    queues_.push_back(make_unique<WorkQueue>());
+  for (int i = 0; i < threads_number; i++)
+    threads_.emplace_back([this, i, low_priority]() { Run(i, low_priority); });
+}
+
+ThreadPool::~ThreadPool() {
+  Stop();
+  Join();
+}
+
+void ThreadPool::Add(std::function<void()> &&function) noexcept {
+  int self = CurrentIndex();
+  size_t index = self >= 0 ? self : next_queue_++ % queues_.size();
+  auto &queue = *queues_[index];
+  {
+    lock_guard<mutex> lock(queue.queue_mutex);
+    queue.tasks.push_back(std::move(function));
+  }
+  pending_++;
+  /* 先加锁再唤醒，避免和准备睡眠的线程错过通知 */
+  lock_guard<mutex> lock(sleep_mutex_);
+  sleep_cond_.notify_one();
+}
+
+void ThreadPool::RunAndWait(vector<function<void()>> &&functions) {
+  mutex done_mutex;
+  condition_variable done_cond;
+  size_t remaining = functions.size();
+  for (auto &function : functions) {
+    Add([&, function = std::move(function)]() {
+      function();
+      lock_guard<mutex> lock(done_mutex);
+      if (--remaining == 0) done_cond.notify_all();
+    });
+  }
+  for (;;) {
+    {
+      lock_guard<mutex> lock(done_mutex);
+      if (remaining == 0) return;
+    }
+    if (RunPendingTask()) continue;
+    /* 剩下的任务都在其它线程上执行，等它们完成 */
+    unique_lock<mutex> lock(done_mutex);
+    done_cond.wait(lock, [&]() { return remaining == 0; });
+    return;
+  }
+}
+
+bool ThreadPool::RunPendingTask() {
+  function<void()> task;
+  if (!PopTask(CurrentIndex(), task)) return false;
+  task();
+  return true;
 }
 
-void Worker::Join() { thread_->join(); }
-void Worker::Stop() {
-  lock_guard<mutex> lock(work_queue_mutex_);
+void ThreadPool::Stop() {
   closed_ = true;
-  work_queue_cond_.notify_all();
+  lock_guard<mutex> lock(sleep_mutex_);
+  sleep_cond_.notify_all();
 }
 
-void Worker::Add(std::function<void()> &&function) noexcept {
-  // fmt::print("Want Add work to queue\n");
-  lock_guard<mutex> lock(work_queue_mutex_);
-  // fmt::print("Add work to queue\n");
-  work_queue_.push(std::move(function));
-  /* 唤醒消费者 */
-  work_queue_cond_.notify_one();
+void ThreadPool::Join() {
+  for (auto &thread : threads_)
+    if (thread.joinable()) thread.join();
 }
 
-void Worker::Run() { return this->operator()(); }
+bool ThreadPool::PopTask(int self, function<void()> &task) {
+  if (pending_ == 0) return false;
+  int n = (int)queues_.size();
+  for (int i = 0; i < n; i++) {
+    int index = self >= 0 ? (self + i) % n : (int)(next_queue_ + i) % n;
+    auto &queue = *queues_[index];
+    lock_guard<mutex> lock(queue.queue_mutex);
+    if (queue.tasks.empty()) continue;
+    /* 自己的队列取最新的任务，窃取时取最旧的任务 */
+    if (index == self) {
+      task = std::move(queue.tasks.back());
+      queue.tasks.pop_back();
+    } else {
+      task = std::move(queue.tasks.front());
+      queue.tasks.pop_front();
+    }
+    pending_--;
+    return true;
+  }
+  return false;
+}
 
-void Worker::operator()() {
+int ThreadPool::CurrentIndex() const {
+  return current_pool == this ? current_index : -1;
+}
+
+void ThreadPool::Run(int index, bool low_priority) {
+  current_pool = this;
+  current_index = index;
+#ifdef __linux__
+  /* linux 上 nice 值是线程级别的，调高它不需要特权 */
+  if (low_priority) setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), 10);
+#endif
+  function<void()> task;
   while (!closed_) {
-    // fmt::print("Worker want get work_queue_mutex_\n");
-    unique_lock<mutex> lock(work_queue_mutex_);
-    // fmt::print("Worker get work_queue_mutex_\n");
-    // fmt::print("Worker wait for tasks...\n");
-    while (!closed_ && work_queue_.empty()) work_queue_cond_.wait(lock);
-    // fmt::print("Worker wake up...\n");
-    if (closed_) break;
-    auto task = work_queue_.front();
-    work_queue_.pop();
-    lock.unlock();
-    // fmt::print("Worker unlock work_queue_mutex_\n");
     /* 注意任务得在无锁的情况下跑，不然可能会死锁的 */
-    // fmt::print("Worker Before do task\n");
-    task();
-    // fmt::print("Worker After do task\n");
+    if (PopTask(index, task)) {
+      task();
+      task = nullptr;
+      continue;
+    }
+    unique_lock<mutex> lock(sleep_mutex_);
+    sleep_cond_.wait(lock, [this]() { return closed_ || pending_ > 0; });
   }
 }
-
-Worker::Worker() : closed_(false) {}
-
-Worker::~Worker() { delete thread_; }
-}  // namespace adl
\ No newline at end of file
+}  // namespace adl
@@ -2,36 +2,59 @@
 #define ADL_LSM_TREE_BACK_GROUND_WORKER_H__
 #include <atomic>
 #include <condition_variable>
+#include <deque>
 #include <functional>
+#include <memory>
 #include <mutex>
-#include <queue>
+#include <thread>
+#include <vector>
 
 namespace adl {
 using namespace std;
 
-class Worker {
+/**
+ * @brief work stealing 线程池：每个线程有自己的任务双端队列，
+ * 池内线程提交的任务放入自己队列的尾部并按 LIFO 执行，外部提交的任务轮流放入各个队列，
+ * 空闲的线程从其它队列的头部窃取任务，不会所有线程争抢同一个锁。
+ * low_priority 的线程以较低的系统调度优先级运行，用于不着急的后台任务。
+ */
+class ThreadPool {
  public:
-  static Worker *NewBackgroundWorker();
-
-  Worker();
-  ~Worker();
-  Worker(const Worker &) = delete;
-  Worker &operator=(const Worker &) = delete;
-  void Stop();
+  ThreadPool(int threads_number, bool low_priority = false);
+  ~ThreadPool();
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
 
   void Add(std::function<void()> &&function) noexcept;
-
-  void Run();
+  /* 提交一组任务并等待全部完成，等待期间调用者也执行排队的任务，
+   * 线程池中没有空闲线程时也不会卡住 */
+  void RunAndWait(vector<function<void()>> &&functions);
+  /* 在调用者线程上执行一个排队的任务，没有任务时返回 false */
+  bool RunPendingTask();
+  /* 停止后还在队列中的任务不会再被池内线程执行 */
+  void Stop();
   void Join();
-  void operator()();
 
  private:
-  queue<function<void()>> work_queue_;
-
-  mutex work_queue_mutex_;
-  condition_variable work_queue_cond_;
-  std::thread *thread_;
-  bool closed_;
+  struct WorkQueue {
+    mutex queue_mutex;
+    deque<function<void()>> tasks;
+  };
+
+  /* 先取自己队列的尾部，再从其它队列的头部窃取，self 为 -1 表示外部线程 */
+  bool PopTask(int self, function<void()> &task);
+  /* 当前线程在这个线程池中的编号，外部线程为 -1 */
+  int CurrentIndex() const;
+  void Run(int index, bool low_priority);
+
+  vector<unique_ptr<WorkQueue>> queues_;
+  vector<std::thread> threads_;
+  std::atomic<size_t> next_queue_;
+  /* 所有队列中的任务总数，空闲线程据此决定是否睡眠 */
+  std::atomic<int> pending_;
+  mutex sleep_mutex_;
+  condition_variable sleep_cond_;
+  std::atomic<bool> closed_;
 };
 
 }  // namespace adl
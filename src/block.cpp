@@ -94,6 +94,15 @@ RC BlockReader::Init(
   return OK;
 }
 
+RC BlockReader::Init(
+    string &&data, std::function<int(string_view, string_view)> &&cmp,
+    std::function<RC(string_view, string_view, string_view innner_key,
+                     string &key, string &value)> &&handle_result) {
+  owned_data_ = std::move(data);
+  return Init(string_view(owned_data_), std::move(cmp),
+              std::move(handle_result));
+}
+
 /* 找到恰好大于等于 inner_key 的项执行 handle_result() */
 RC BlockReader::GetInternal(
     string_view inner_key,
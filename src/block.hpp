@@ -121,6 +121,12 @@ class BlockReader : public enable_shared_from_this<BlockReader> {
           std::function<RC(string_view result_key, string_view result_value,
                            string_view want_inner_key, string &key,
                            string &value)> &&handle_result);
+  /* 数据块会放进 block cache，可能比所在 sstable 的 mmap 活得更久，
+   * 这时需要持有一份自己的数据 */
+  RC Init(string &&data, std::function<int(string_view, string_view)> &&cmp,
+          std::function<RC(string_view result_key, string_view result_value,
+                           string_view want_inner_key, string &key,
+                           string &value)> &&handle_result);
 
   /* 点查 */
   RC Get(string_view want_key, string &key, string &value);
@@ -131,6 +137,7 @@ class BlockReader : public enable_shared_from_this<BlockReader> {
       string_view key,
       const std::function<RC(string_view, string_view)> &handle_result);
 
+  string owned_data_;       /* 自己持有数据时 data_ 指向这里 */
   string_view data_;        /* [data][restarts] */
   string_view data_buffer_; /* [data] */
   /* 既是重启点数组的起点偏移量，也是数据项的结束偏移量 */
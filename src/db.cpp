@@ -5,7 +5,9 @@
 #include <cstdint>
 #include <memory>
 #include <mutex>
+#include <queue>
 #include <sstream>
+#include <thread>
 #include "defer.hpp"
 #include "file_util.hpp"
 #include "hash_util.hpp"
@@ -20,12 +22,14 @@ namespace adl {
 DB::DB(string_view dbname, DBOptions &options)
     : dbname_(dbname),
       sequence_id_(0),
+      last_sequence_(-1),
       log_number_(0),
+      next_run_id_(1),
       options_(&options),
       mem_(nullptr),
-      imem_(nullptr),
       closed_(false),
-      is_compacting_(false),
+      running_compactions_(0),
+      compacting_levels_(5, false),
       save_backgound_rc_(OK),
       table_cache_(make_unique<
                    LRUCache<string, shared_ptr<SSTableReader>, std::mutex>>()),
@@ -33,10 +37,14 @@ DB::DB(string_view dbname, DBOptions &options)
           make_unique<
               LRUCache<BlockCacheHandle, shared_ptr<BlockReader>, std::mutex>>(
               options.block_cache_size)) {
-  /* 后台工作者线程，目前只有一个线程 */
   MLogger.SetDbNameAndOptions(dbname_, &options);
-  for (int i = 0; i < options_->background_workers_number; i++)
-    workers_.push_back(Worker::NewBackgroundWorker());
+  /* 落盘和压实各自排队，压实可以选择以较低的系统优先级运行，
+   * 压实线程池多出的线程用来窃取 subcompaction 子任务 */
+  flush_pool_ = make_unique<ThreadPool>(options_->max_background_flushes);
+  compaction_pool_ = make_unique<ThreadPool>(
+      options_->max_background_compactions +
+          max(options_->max_subcompactions - 1, 0),
+      options_->lower_compaction_cpu_priority);
   MLog->info("DB will run in {}", dbname_);
   current_rev_ = make_shared<Revision>(this);
 }
@@ -44,11 +52,13 @@ DB::DB(string_view dbname, DBOptions &options)
 DB::~DB() {
   MLog->info("DB is closing");
   if (!closed_) Close();
-  for (auto worker : workers_) {
-    worker->Stop();
-    worker->Join();
-    delete worker;
-  }
+  flush_pool_->Stop();
+  compaction_pool_->Stop();
+  flush_pool_->Join();
+  compaction_pool_->Join();
+  /* 没来得及安装的落盘结果，数据仍然在 wal 中 */
+  for (auto &[_, files] : flush_results_)
+    for (auto meta : files) delete meta;
   MLog->info("DB closed");
   spdlog::drop(options_->logger_name);
 }
@@ -75,9 +85,10 @@ RC DB::Open(string_view dbname, DBOptions &options, DB **dbptr) {
     rc = FileManager::OpenWAL(true_dbname, log_number, &wal);
     if (rc) return rc;
     db->current_rev_->PushLogNumber(log_number);
-    db->mem_ = make_shared<MemTable>(*db->options_, wal);
+    db->mem_ = make_shared<MemTable>(*db->options_, wal, log_number);
     db->WriteCurrentRev(&*db->current_rev_);
   }
+  db->InstallSuperVersion();
   *dbptr = db;
   return OK;
 }
@@ -127,8 +138,9 @@ RC DB::Create(string_view dbname, DBOptions &options, DB **dbptr) {
   rc = FileManager::OpenWAL(dbname, log_number, &wal);
   if (rc) return rc;
   db->current_rev_->PushLogNumber(log_number);
-  db->mem_ = make_shared<MemTable>(*db->options_, wal);
+  db->mem_ = make_shared<MemTable>(*db->options_, wal, log_number);
   db->WriteCurrentRev(&*db->current_rev_);
+  db->InstallSuperVersion();
   MLog->info("DB init rev {}", db->current_rev_->GetOid());
   *dbptr = db;
   return rc;
@@ -146,7 +158,9 @@ RC DB::Close() {
 }
 
 RC DB::Put(string_view key, string_view value) {
-  if (auto rc = Write(key, value, OP_PUT); rc) {
+  WriteBatch batch;
+  batch.Put(key, value);
+  if (auto rc = Write(batch); rc) {
     MLog->error("Put key:{} value:{} failed", key, value);
     return rc;
   }
@@ -154,39 +168,49 @@ RC DB::Put(string_view key, string_view value) {
 }
 
 RC DB::Delete(string_view key) {
-  if (auto rc = Write(key, "", OP_DELETE); rc) {
+  WriteBatch batch;
+  batch.Delete(key);
+  if (auto rc = Write(batch); rc) {
     MLog->error("Delete key:{} failed", key);
     return rc;
   }
   return OK;
 }
 
+/* 读取不加锁：先取序列号再取 super version，
+ * 序列号以内的写入一定都在这个或更新的 super version 中 */
 RC DB::Get(string_view key, std::string &value) {
+  return Get(ReadOptions(), key, value);
+}
+
+RC DB::Get(const ReadOptions &options, string_view key, std::string &value) {
   RC rc = OK;
-  unique_lock<mutex> lock(mutex_);
-  auto mem = mem_;
-  auto imem = imem_;
-  auto current_rev = current_rev_;
-  auto current_seq = sequence_id_.load(std::memory_order::relaxed);
-
-  lock.unlock();
-  /* 1. memtable */
-  rc = mem->Get(key, value, current_seq);
-  if (!rc) {
+  /* 快照的数据由压实保留，用最新的 super version 读取即可 */
+  auto current_seq = options.snapshot
+                         ? options.snapshot->GetSequence()
+                         : last_sequence_.load(std::memory_order::acquire);
+  auto sv = super_version_.load(std::memory_order::acquire);
+  const auto &imms = sv->imms;
+  const auto &current_rev = sv->current;
+
+  /* 1. memtable，较新的删除标记会遮住所有更旧的数据 */
+  rc = sv->mem->GetNoLock(key, value, current_seq);
+  if (rc != NOT_FOUND) {
     MLog->debug("Get key {} hit in memtable", key);
-    return rc;
+    return rc == KEY_DELETED ? NOT_FOUND : rc;
   }
-  /* 2. imemtable */
-  if (imem) {
-    rc = imem->GetNoLock(key, value, current_seq);
-    if (!rc) {
+  /* 2. imemtable 从新到旧 */
+  for (auto iter = imms.rbegin(); iter != imms.rend(); ++iter) {
+    rc = (*iter)->GetNoLock(key, value, current_seq);
+    if (rc != NOT_FOUND) {
       MLog->debug("Get key {} hit in imemtable", key);
-      return rc;
+      return rc == KEY_DELETED ? NOT_FOUND : rc;
     }
   }
 
   /* 3 L0 sstable | L1-LN sstable 需要依赖于版本控制 元数据管理 */
   rc = current_rev->Get(key, value, current_seq);
+  if (rc == KEY_DELETED) return NOT_FOUND;
   if (!rc) {
     MLog->debug("Get key {} value {} hint in current rev {}", key, value,
                 current_rev->GetOid());
@@ -196,6 +220,25 @@ RC DB::Get(string_view key, std::string &value) {
   return NOT_FOUND;
 }
 
+const Snapshot *DB::GetSnapshot() {
+  lock_guard<mutex> lock(mutex_);
+  auto snapshot = new Snapshot(last_sequence_.load(memory_order_acquire));
+  snapshots_.insert(snapshot->GetSequence());
+  return snapshot;
+}
+
+void DB::ReleaseSnapshot(const Snapshot *snapshot) {
+  {
+    lock_guard<mutex> lock(mutex_);
+    snapshots_.erase(snapshots_.find(snapshot->GetSequence()));
+  }
+  delete snapshot;
+}
+
+int64_t DB::SmallestSnapshot() {
+  return snapshots_.empty() ? last_sequence_.load() : *snapshots_.begin();
+}
+
 void DB::Debug() { MLog->info("@DB [current_rev_:{}\n]\n", *current_rev_); }
 RC DB::DebugSSTable(string_view oid) {
   shared_ptr<SSTableReader> sstable;
@@ -214,124 +257,176 @@ RC DB::DebugSSTable(string_view oid) {
   return OK;
 }
 
-/* 目前写入的并发策略是整个 Write Db锁，因为想要保护 memtable
- * 否则一个写入线程修改 mem = new MemTable 这个线程不加锁读取 mem
- * 是有问题的。 */
-RC DB::Write(string_view key, string_view value, OpType op) {
+/* 写入采用组提交：写者先进入 writers_ 队列排队，队首的写者成为 leader，
+ * 它把队列中所有等待的写者的 batch 合并成一个 batch，占用一段连续的序列号，
+ * 作为一条记录追加到 wal 并只 sync 一次，然后写入 memtable
+ * 并唤醒这一组的 follower。
+ * 只有 leader 会写 mem_，所以写 wal 和 memtable 时可以解锁。 */
+RC DB::Write(const WriteBatch &batch) {
+  if (!batch.Count()) return OK;
+  Writer w(&batch);
   unique_lock<mutex> lock(mutex_);
+  writers_.push_back(&w);
+  while (!w.done && &w != writers_.front()) w.cond.wait(lock);
+  /* 已经被其它 leader 顺带写入了 */
+  if (w.done) return w.rc;
+
   /* check if need freeze mem or compaction 这可能需要好一会儿 */
-  if (auto rc = MaybeDoCompaction(); rc) {
+  Writer *last_writer = &w;
+  RC rc = MaybeDoCompaction(lock);
+  if (rc) {
     MLog->error("DB CheckMemAndCompaction failed: {}", strrc(rc));
-    return rc;
+  } else {
+    /* write memtable and wal */
+    WriteBatch *group = BuildWriteGroup(&last_writer);
+    int64_t seq = sequence_id_.fetch_add(group->Count(), memory_order_relaxed);
+    group->SetSequence(seq);
+    auto mem = mem_;
+    lock.unlock();
+    rc = mem->WriteTeeWAL(*group);
+    lock.lock();
+    /* 整个 batch 已经写入 memtable，对读可见 */
+    if (!rc)
+      last_sequence_.store(seq + group->Count() - 1, memory_order_release);
+  }
+
+  /* 唤醒这一组中的 follower */
+  while (true) {
+    Writer *ready = writers_.front();
+    writers_.pop_front();
+    if (ready != &w) {
+      ready->rc = rc;
+      ready->done = true;
+      ready->cond.notify_one();
+    }
+    if (ready == last_writer) break;
   }
-
-  /* write memtable and wal */
-  MemKey mem_key(key, sequence_id_.fetch_add(1, memory_order_relaxed), op);
-  auto mem = mem_;
-  lock.unlock();
-  return mem->PutTeeWAL(mem_key, value);
+  /* 下一组的 leader */
+  if (!writers_.empty()) writers_.front()->cond.notify_one();
+  return rc;
 }
 
-/* 由于读 imem_ 需要锁定 */
-RC DB::MaybeDoCompaction() {
-  /* 表示已经锁 */
-  unique_lock<mutex> lock(mutex_, adopt_lock);
+/* 从队首开始把等待的写者的 batch 合并到 write_group_ 中 */
+WriteBatch *DB::BuildWriteGroup(Writer **last_writer) {
+  /* 限制一组的大小，避免 leader 的延迟过大 */
+  static constexpr size_t max_group_size = 1UL << 20; /* 1MB */
 
-  while (!closed_) {
-    bool need_minor = NeedMinorCompactions();
-    bool need_major = NeedMajorCompactions();
-    if (!need_minor && !need_major)
+  write_group_.Clear();
+  for (auto writer : writers_) {
+    if (write_group_.Count() &&
+        write_group_.ApproximateSize() + writer->batch->ApproximateSize() >
+            max_group_size)
       break;
-    else if (need_minor) {
-      /* memtable 满了，如果 imem 非空 等待
-      minor compaction 将 imem 置为空 */
-      MLog->info("MaybeDoCompaction wait for imem empty");
-      while (!closed_ && !save_backgound_rc_ && imem_)
-        background_work_done_cond_.wait(lock);
-
-      if (save_backgound_rc_)
-        return save_backgound_rc_;
-      else if (closed_)
-        return OK;
-
-      MLog->info("MaybeDoCompaction wait imem empty done");
-      /* mem -> imem */
-      if (auto rc = FreezeMemTable(); rc) return rc;
-
-      if (!is_compacting_) {
-        is_compacting_ = true;
-        workers_[0]->Add([this]() { DoCompaction(); });
-      }
-      MLog->info("MaybeDoCompaction wait new imem empty");
-      while (!closed_ && !save_backgound_rc_ && imem_)
-        background_work_done_cond_.wait(lock);
-      MLog->info("MaybeDoCompaction wait new imem empty done");
-
-    } else if (need_major) {
-      if (!is_compacting_) {
-        is_compacting_ = true;
-        workers_[0]->Add([this]() { DoCompaction(); });
-      }
+    write_group_.Append(*writer->batch);
+    *last_writer = writer;
+  }
+  return &write_group_;
+}
 
-      // while (!closed_ && !save_backgound_rc_)
+/* 由于读 imms_ 需要锁定，调用者需持有 lock */
+RC DB::MaybeDoCompaction(unique_lock<mutex> &lock) {
+  while (!closed_) {
+    if (save_backgound_rc_) return save_backgound_rc_;
+    /* 压实在后台进行，L0 堆积太多文件且有压实在进行时写入才等待 */
+    MaybeScheduleMajorCompaction();
+    if (running_compactions_ > 0 &&
+        current_rev_->GetLevel(0).RunsCount() >=
+            options_->level0_stop_writes_trigger) {
+      MLog->info("MaybeDoCompaction wait for major compaction");
       background_work_done_cond_.wait(lock);
+      continue;
     }
-
-    if (save_backgound_rc_)
-      return save_backgound_rc_;
-    else if (closed_)
-      return OK;
+    if (!NeedMinorCompactions()) break;
+    /* 不可变内存表已经攒满了，等待最旧的一个落盘 */
+    if ((int)imms_.size() >= options_->max_immutable_memtables) {
+      MLog->info("MaybeDoCompaction wait for imms flush");
+      background_work_done_cond_.wait(lock);
+      continue;
+    }
+    /* mem -> imms，落盘在后台进行，写入不需要等待 */
+    if (auto rc = FreezeMemTable(); rc) return rc;
+    auto imm = imms_.back();
+    flush_pool_->Add([this, imm]() { DoMinorCompaction(imm); });
   }
-  lock.release();
+  if (save_backgound_rc_) return save_backgound_rc_;
   return OK;
 }
 
-/* background thread do compaction */
-/* 由于读 imem_ 需要锁定 */
+/* 需要持有 mutex_，每次最多提交一个压实任务 */
+void DB::MaybeScheduleMajorCompaction() {
+  if (closed_ ||
+      running_compactions_ >= options_->max_background_compactions ||
+      !NeedMajorCompactions())
+    return;
+  running_compactions_++;
+  compaction_pool_->Add([this]() { DoCompaction(); });
+}
+
+/* background thread do major compaction */
 void DB::DoCompaction() {
   MLog->info("DB will do compaction");
   RC rc = OK;
-  lock_guard<mutex> lock(mutex_);
+  unique_lock<mutex> lock(mutex_);
   MLog->info("DB get the lock");
 
   defer _([&]() {
-    is_compacting_ = false;
+    running_compactions_--;
     background_work_done_cond_.notify_all();
   });
 
   /* 疯狂压实 */
-  while (!closed_) {
-    bool need_major = NeedMajorCompactions();
-    if (!imem_ && !need_major) {
-      MLog->info("DB dont't need compaction?");
+  while (!closed_ && NeedMajorCompactions()) {
+    if (rc = DoMajorCompaction(lock); rc) {
+      save_backgound_rc_ = rc;
+      MLog->error("DB compaction failed: {}", strrc(rc));
       break;
     }
+    /* 唤醒因为 L0 堆积而等待的写者 */
+    background_work_done_cond_.notify_all();
+    /* 其它层也需要压实时交给空闲的压实线程并行进行 */
+    MaybeScheduleMajorCompaction();
+  }
+}
 
-    if (imem_) {
-      /* minor compaction */
-      rc = DoMinorCompaction();
-    } else if (need_major) {
-      /* major compaction */
-      rc = DoMajorCompaction();
-    }
+/* 生成 sstable 时不持有锁，安装时再加锁 */
+void DB::DoMinorCompaction(shared_ptr<MemTable> imm) {
+  MLog->info("DB is doing minor compaction");
+  RC rc = OK;
+  vector<FileMetaData *> files;
+  if (!imm->Empty())
+    rc = imm->BuildSSTable(dbname_, next_run_id_.fetch_add(1), files);
 
+  vector<shared_ptr<MemTable>> installed;
+  {
+    lock_guard<mutex> lock(mutex_);
     if (rc) {
+      MLog->error("DB build sstable failed: {}", strrc(rc));
       save_backgound_rc_ = rc;
-      MLog->error("DB compaction failed: {}", strrc(rc));
+    } else {
+      flush_results_[imm.get()] = std::move(files);
+      if (rc = InstallFlushResults(installed); rc) save_backgound_rc_ = rc;
     }
+    MaybeScheduleMajorCompaction();
+    background_work_done_cond_.notify_all();
   }
+
+  /* 由于 memtable 已经落盘并且不再被版本引用，丢弃 wal */
+  for (auto &mem : installed) mem->DropWAL();
 }
 
-/* 由于写 imem_ 需要锁定 */
-RC DB::DoMinorCompaction() {
-  MLog->info("DB is doing minor compaction");
-  if (auto rc = BuildSSTable(imem_); rc) {
-    MLog->error("DB build sstable failed: {}", strrc(rc));
-    return rc;
+/* 按冻结的顺序安装已经落盘的 imm，需要持有 mutex_ */
+RC DB::InstallFlushResults(vector<shared_ptr<MemTable>> &installed) {
+  while (!imms_.empty()) {
+    auto iter = flush_results_.find(imms_.front().get());
+    if (iter == flush_results_.end()) break;
+    vector<FileMetaData *> files = std::move(iter->second);
+    flush_results_.erase(iter);
+    auto rc = InstallSSTable(files, imms_.front()->GetLogNumber());
+    if (rc) return rc;
+    installed.push_back(std::move(imms_.front()));
+    imms_.pop_front();
+    InstallSuperVersion();
   }
-  /* 由于memtable 已经落盘，丢弃 wal + Imem  */
-  imem_->DropWAL();
-  imem_.reset();
   return OK;
 }
 
@@ -363,44 +458,74 @@ RC DB::GetSSTableReader(const string &oid, shared_ptr<SSTableReader> &sstable) {
   return rc;
 }
 
-RC DB::DoMajorCompaction() {
+/* 在锁内取得输入文件的快照，合并和文件读写都在锁外进行，
+ * 最后重新加锁，基于最新的版本安装结果。调用者需持有 lock */
+RC DB::DoMajorCompaction(unique_lock<mutex> &lock) {
   RC rc = OK;
 
   MLog->info("DB is doing major compaction");
 
-  int level = current_rev_->PickBestCompactionLevel();
-
-  if (level == -1) /* nothing todo */
-    return OK;
-
-  const auto &level_obj = current_rev_->GetLevel(level);
+  /* 输入文件的快照，合并期间 L0 可能会有新的文件加入 */
+  Compaction compaction;
+  if (!current_rev_->PickCompaction(&compaction, compacting_levels_))
+    return OK; /* nothing todo */
+  /* 比最旧的快照还新的版本都要保留，合并期间新建的快照只会更新 */
+  compaction.smallest_snapshot = SmallestSnapshot();
+  /* 合并期间其它压实任务不能再选择这两层 */
+  compacting_levels_[compaction.level] = true;
+  compacting_levels_[compaction.OutputLevel()] = true;
+  defer release([&]() {
+    compacting_levels_[compaction.level] = false;
+    compacting_levels_[compaction.OutputLevel()] = false;
+  });
 
-  /* 对 level_obj 中所有 sort_run 进行合并
+  /* 对所有输入的 sort_run 进行合并
   创建新的 L[level+1] sstable */
-  FileMetaData *sstable_file_meta = nullptr;
-
-  /* 进行 merge 合并 */
-  if (rc = MergeRuns(level_obj, &sstable_file_meta); rc) {
-    MLog->error("DB merge runs failed: {}", strrc(rc));
-    return rc;
+  vector<FileMetaData *> files;
+
+  if (compaction.trivial_move) {
+    /* 不需要读写数据，sstable 的路径只和 SHA 有关，直接移动元数据 */
+    MLog->info("DB trivial move {} files from L{}", compaction.inputs[0].size(),
+               compaction.level);
+    for (auto &file_meta : compaction.inputs[0]) {
+      auto moved = new FileMetaData(*file_meta);
+      moved->belong_to_level = compaction.OutputLevel();
+      files.push_back(moved);
+    }
+  } else {
+    lock.unlock();
+    rc = MergeRuns(compaction, files);
+    lock.lock();
+    /* 进行 merge 合并 */
+    if (rc) {
+      MLog->error("DB merge runs failed: {}", strrc(rc));
+      return rc;
+    }
   }
   MLog->info("DB major ok!");
 
-  defer de([&]() {
-    if (rc && sstable_file_meta) delete sstable_file_meta;
-  });
-
-  vector<Level> new_levels = current_rev_->GetLevels();
   /* 更新层级文件元数据 */
-  if (!sstable_file_meta || sstable_file_meta->belong_to_level >= 5 ||
-      sstable_file_meta->belong_to_level < 0)
-    return BAD_FILE_META;
-  auto &new_level = new_levels[sstable_file_meta->belong_to_level];
-  new_level.Insert(sstable_file_meta);
-  /* 创建新 N+1 层级对象文件 */
-  if (rc = new_level.BuildFile(dbname_); rc) return rc;
-  /* N 层 清空 */
-  new_levels[level].Clear();
+  for (auto file_meta : files) {
+    if (file_meta->belong_to_level >= 5 || file_meta->belong_to_level < 0) {
+      for (auto meta : files) delete meta;
+      return BAD_FILE_META;
+    }
+  }
+  vector<Level> new_levels = current_rev_->GetLevels();
+  /* 只移除参与合并的文件，N+1 层插入新文件 */
+  for (int i = 0; i < 2; i++)
+    for (auto &file_meta : compaction.inputs[i])
+      new_levels[compaction.level + i].Erase(file_meta.get());
+  for (auto file_meta : files)
+    new_levels[file_meta->belong_to_level].Insert(file_meta);
+  /* 创建新 N 和 N+1 层级对象文件 */
+  for (int i = 0; i < 2; i++) {
+    auto &new_level = new_levels[compaction.level + i];
+    if (new_level.Empty())
+      new_level.Clear();
+    else if (rc = new_level.BuildFile(dbname_); rc)
+      return rc;
+  }
 
   deque<int64_t> new_log_nums = current_rev_->GetLogNumbers();
   /* 创建新版本对象文件 */
@@ -425,42 +550,102 @@ struct MergeCmp {
   }
 };
 
-RC DB::MergeRuns(const Level &level, FileMetaData **meta_data_pointer) {
+/* 用输入文件的 min key 将 key 空间分成最多 max_subcompactions 个范围，
+ * 第 i 个范围是 [boundaries[i-1], boundaries[i]) */
+static void PickSubCompactionBoundaries(const Compaction &compaction,
+                                        int max_subcompactions,
+                                        vector<string> &boundaries) {
+  if (max_subcompactions <= 1) return;
+  vector<string> keys;
+  for (auto &inputs : compaction.inputs)
+    for (auto &file_meta : inputs)
+      keys.push_back(file_meta->min_inner_key.user_key_);
+  sort(keys.begin(), keys.end());
+  keys.erase(unique(keys.begin(), keys.end()), keys.end());
+  /* 最小的 key 作为分界没有意义 */
+  if (!keys.empty()) keys.erase(keys.begin());
+  int n = min(max_subcompactions, (int)keys.size() + 1);
+  for (int i = 1; i < n; i++) boundaries.push_back(keys[i * keys.size() / n]);
+}
+
+RC DB::MergeRuns(const Compaction &compaction, vector<FileMetaData *> &files) {
+  MLog->info("DB merge runs L{} {} files + L{} {} files", compaction.level,
+             compaction.inputs[0].size(), compaction.OutputLevel(),
+             compaction.inputs[1].size());
+
+  /* 所有子任务的输出属于同一个 run */
+  int64_t run_id = next_run_id_.fetch_add(1);
+  vector<string> boundaries;
+  PickSubCompactionBoundaries(compaction, options_->max_subcompactions,
+                              boundaries);
+  if (boundaries.empty())
+    return DoSubCompaction(compaction, nullptr, nullptr, run_id, files);
+
+  /* 每个范围作为一个子任务交给压实线程池，空闲的线程会窃取执行，
+   * 当前线程等待时也会执行子任务。各自输出文件，范围之间互不重叠 */
+  int n = (int)boundaries.size() + 1;
+  vector<vector<FileMetaData *>> outputs(n);
+  vector<RC> rcs(n, OK);
+  vector<function<void()>> tasks;
+  for (int i = 0; i < n; i++) {
+    const string *smallest = i == 0 ? nullptr : &boundaries[i - 1];
+    const string *largest = i == n - 1 ? nullptr : &boundaries[i];
+    tasks.push_back([&, i, smallest, largest]() {
+      rcs[i] =
+          DoSubCompaction(compaction, smallest, largest, run_id, outputs[i]);
+    });
+  }
+  compaction_pool_->RunAndWait(std::move(tasks));
+  MLog->info("DB merge runs with {} subcompactions", n);
+
+  RC rc = OK;
+  for (auto sub_rc : rcs)
+    if (sub_rc) rc = sub_rc;
+  for (auto &output : outputs) {
+    if (rc)
+      for (auto file_meta : output) delete file_meta;
+    else
+      files.insert(files.end(), output.begin(), output.end());
+  }
+  return rc;
+}
+
+RC DB::DoSubCompaction(const Compaction &compaction, const string *smallest,
+                       const string *largest, int64_t run_id,
+                       vector<FileMetaData *> &files) {
   RC rc = OK;
 
   priority_queue<SSTableReader::Iterator, vector<SSTableReader::Iterator>,
                  MergeCmp>
       iter_pq;
-  FileMetaData *meta_data = new FileMetaData;
-
-  /* 将所有 LN 的 sstable 的 begin() 迭代器加入到优先队列中 */
-  const auto &files_meta = level.GetSSTableFilesMeta();
 
-  MLog->info("DB merge runs on {}", level);
+  /* 将所有和范围重叠的输入 sstable 的迭代器加入到优先队列中 */
+  for (auto &inputs : compaction.inputs) {
+    for (auto &file_meta : inputs) {
+      if ((smallest && file_meta->max_inner_key.user_key_ < *smallest) ||
+          (largest && file_meta->min_inner_key.user_key_ >= *largest))
+        continue;
+      shared_ptr<SSTableReader> sstable;
+      rc = GetSSTableReader(sha256_digit_to_hex(file_meta->sha256), sstable);
+      if (rc) {
+        MLog->debug("GetSSTableReader failed with {}", strrc(rc));
+        return rc;
+      }
 
-  for (auto iter = files_meta.rbegin(); iter != files_meta.rend(); ++iter) {
-    auto &file_meta = *iter;
-    shared_ptr<SSTableReader> sstable;
-    rc = GetSSTableReader(sha256_digit_to_hex(file_meta->sha256), sstable);
-    if (rc) {
-      MLog->debug("GetSSTableReader failed with {}", strrc(rc));
-      return rc;
+      auto block_iter = sstable->begin();
+      if (smallest) block_iter.Seek(NewMinInnerKey(*smallest));
+      if (block_iter == block_iter.GetContainerEnd()) continue;
+      if (!block_iter.Valid()) block_iter.Fetch();
+      iter_pq.push(block_iter);
     }
-
-    auto block_iter = sstable->begin();
-    if (!block_iter.Valid()) block_iter.Fetch();
-    iter_pq.push(block_iter);
   }
 
-  auto sstable_ok = NewSSTableWriter(dbname_, options_);
-  if (!sstable_ok) return NEW_SSTABLE_ERROR;
-  auto merge_sstable_writer = std::move(sstable_ok.value());
-
+  SSTableSplitWriter writer(dbname_, options_, compaction.OutputLevel(),
+                            run_id);
   string last_key;
-  int count = 0;
-  int64_t max_seq = 0;
-  MemKey max_key;
-  MemKey min_key;
+  /* 同一个 user key 上一个版本的序列号，新的 user key 从 INT64_MAX 开始 */
+  int64_t last_sequence_for_key = INT64_MAX;
+  int64_t dropped = 0;
 
   while (iter_pq.size()) {
     /* 从优先队列中拿出所有 sstable 中 CmpInnerKey 最小的项的 kv, 出队
@@ -470,17 +655,26 @@ RC DB::MergeRuns(const Level &level, FileMetaData **meta_data_pointer) {
     auto cur_value = cur.Value();
 
     iter_pq.pop();
-    /* 如果 user_key 部分和前一个 key 是相同的,那么我们应当将它抛弃 */
-    if (last_key.empty() || CmpUserKeyOfInnerKey(last_key, cur_key)) {
-      /* 目前最后一层的逻辑还是 tiering 后面改成 leveling 后可以删除墓碑 */
-      rc = merge_sstable_writer->Add(cur_key, cur_value);
-      if (rc) return rc;
-      /* 记录第一个 key 后面需要保存 */
-      if (!count) min_key.FromKey(cur_key);
-      max_seq = max(max_seq, InnerKeySeq(cur_key));
-      count++;
+    /* 超出范围的数据由下一个子任务负责，这个文件不需要再读了 */
+    if (largest && InnerKeyToUserKey(cur_key) >= *largest) continue;
+    if (last_key.empty() || CmpUserKeyOfInnerKey(last_key, cur_key))
+      last_sequence_for_key = INT64_MAX;
+    int64_t seq = InnerKeySeq(cur_key);
+    bool drop = false;
+    if (last_sequence_for_key <= compaction.smallest_snapshot) {
+      /* 更新的版本已经对所有读者可见，这个版本不会再被读到 */
+      drop = true;
+    } else if (compaction.bottommost && seq <= compaction.smallest_snapshot &&
+               InnerKeyOpType(cur_key) == OP_DELETE) {
+      /* 下面没有更旧的数据了，删除标记本身也不再需要 */
+      drop = true;
     }
+    if (drop)
+      dropped++;
+    else if (rc = writer.Add(cur_key, cur_value); rc)
+      return rc;
 
+    last_sequence_for_key = seq;
     last_key = cur_key;
     cur++;
     /* 如果这个 sstable 还没有到结尾则继续将迭代器加入到优先队列中 */
@@ -490,46 +684,48 @@ RC DB::MergeRuns(const Level &level, FileMetaData **meta_data_pointer) {
     }
   }
 
-  if (rc = merge_sstable_writer->Final(meta_data->sha256); rc) return rc;
-
-  /* 记录最后一个 key 后面需要保存 */
-  max_key.FromKey(last_key);
-
-  meta_data->file_size = merge_sstable_writer->GetFileSize();
-  meta_data->min_inner_key = std::move(min_key);
-  meta_data->max_inner_key = std::move(max_key);
-  meta_data->num_keys = count;
-  /* 目前 minor compaction 生成的 sstable 就放在 l0 */
-  meta_data->belong_to_level = level.GetLevel() + 1;
-  meta_data->max_seq = max_seq;
-  MLog->info("DB merge runs to {}", *meta_data);
-
-  *meta_data_pointer = meta_data;
+  if (rc = writer.Final(files); rc) return rc;
+  MLog->info("DB merge runs dropped {} entries", dropped);
+  for (auto file_meta : files) MLog->info("DB merge runs to {}", *file_meta);
   return rc;
 }
 
-/* imm --> sstable */
+/* imm --> sstable，用于加载 wal */
 RC DB::BuildSSTable(const shared_ptr<adl::MemTable> &mem) {
-  RC rc = OK;
   MLog->info("DB is building sstable");
   if (mem->Empty()) return NOEXCEPT_SIZE;
-  FileMetaData *sstable_file_meta = nullptr;
+  vector<FileMetaData *> files;
   /* 内存数据刷盘  创建新 SSTable 对象文件*/
-  if (auto rc = mem->BuildSSTable(dbname_, &sstable_file_meta); rc) return rc;
-  /* 更新层级文件元数据 */
+  if (auto rc = mem->BuildSSTable(dbname_, next_run_id_.fetch_add(1), files);
+      rc)
+    return rc;
+  return InstallSSTable(files, mem->GetLogNumber());
+}
+
+/* 将新的 sstable 放到 l0 并生成新版本，log_number 对应的 wal 不再需要 */
+RC DB::InstallSSTable(const vector<FileMetaData *> &files,
+                      int64_t log_number) {
+  RC rc = OK;
   vector<Level> new_levels = current_rev_->GetLevels();
-  if (!sstable_file_meta || sstable_file_meta->belong_to_level >= 5 ||
-      sstable_file_meta->belong_to_level < 0)
-    return BAD_FILE_META;
-  auto &new_level = new_levels[sstable_file_meta->belong_to_level];
-  new_level.Insert(sstable_file_meta);
-  /* 创建新层级对象文件 */
-  if (auto rc = new_level.BuildFile(dbname_); rc) return rc;
-
-  /* 最旧的 wal 不需要了 */
   deque<int64_t> new_log_nums = current_rev_->GetLogNumbers();
-  if (new_log_nums.empty()) return NOEXCEPT_SIZE;
-  new_log_nums.pop_front();
+  /* 空的内存表没有生成 sstable，只需要移除 wal */
+  if (!files.empty()) {
+    /* 更新层级文件元数据 */
+    for (auto file_meta : files) {
+      if (file_meta->belong_to_level >= 5 || file_meta->belong_to_level < 0) {
+        for (auto meta : files) delete meta;
+        return BAD_FILE_META;
+      }
+    }
+    for (auto file_meta : files)
+      new_levels[file_meta->belong_to_level].Insert(file_meta);
+    /* 创建新层级对象文件 */
+    auto &new_level = new_levels[files.front()->belong_to_level];
+    if (rc = new_level.BuildFile(dbname_); rc) return rc;
+  }
+
+  auto iter = find(new_log_nums.begin(), new_log_nums.end(), log_number);
+  if (iter != new_log_nums.end()) new_log_nums.erase(iter);
 
   /* 创建新版本对象文件 */
   auto new_revision =
@@ -545,17 +741,18 @@ RC DB::BuildSSTable(const shared_ptr<adl::MemTable> &mem) {
   return OK;
 }
 
-/* mem -> imem */
-/* 由于写 imem 和 mem 需要锁定 */
+/* mem -> imms */
+/* 由于写 imms 和 mem 需要锁定 */
 RC DB::FreezeMemTable() {
-  MLog->info("DB mem -> imem");
-  imem_ = mem_;
+  MLog->info("DB mem -> imms, {} imms", imms_.size());
   WAL *wal = nullptr;
   int64_t log_number = log_number_.fetch_add(1, memory_order_relaxed);
   auto rc = FileManager::OpenWAL(dbname_, log_number, &wal);
   if (rc) return rc;
+  imms_.push_back(mem_);
   current_rev_->PushLogNumber(log_number);
-  mem_ = make_shared<MemTable>(*options_, wal);
+  mem_ = make_shared<MemTable>(*options_, wal, log_number);
+  InstallSuperVersion();
   WriteCurrentRev(&*current_rev_);
   return OK;
 }
@@ -572,7 +769,7 @@ bool DB::NeedCompactions() {
   comapction trigger
 */
 bool DB::NeedMajorCompactions() {
-  return current_rev_->PickBestCompactionLevel() != -1;
+  return current_rev_->PickBestCompactionLevel(compacting_levels_) != -1;
 }
 
 /* 读 mem 需要锁定 */
@@ -585,9 +782,18 @@ RC DB::UpdateCurrentRev(Revision *rev) {
   MLog->info("DB update current rev from {} to {}", current_rev_->GetOid(),
              rev->GetOid());
   current_rev_.reset(rev);
+  InstallSuperVersion();
   return OK;
 }
 
+void DB::InstallSuperVersion() {
+  auto sv = make_shared<SuperVersion>();
+  sv->mem = mem_;
+  sv->imms.assign(imms_.begin(), imms_.end());
+  sv->current = current_rev_;
+  super_version_.store(std::move(sv), std::memory_order::release);
+}
+
 RC DB::WriteCurrentRev(string_view write_buffer) {
   TempFile *temp_current_file = nullptr;
   string current_file_path = CurrentFile(dbname_);
@@ -634,11 +840,11 @@ RC DB::LoadWALs(const deque<int64_t> &log_nums) {
   if (!log_nums_size) MLog->info("No wal for loading");
   MLog->info("there are {} wals", log_nums_size);
 
+  /* 加载完成之前 wal 必须一直被版本引用 */
+  for (int i = 0; i < log_nums_size; i++) current_rev_->PushLogNumber(log_nums[i]);
   for (int i = 0; i < log_nums_size; i++) {
-    auto current_rev = current_rev_;
-    current_rev->PushLogNumber(log_nums[i]);
-    if (rc = LoadWAL(WalFile(WalDir(dbname_), log_nums[i])); rc) return rc;
-    current_rev->PopLogNumber();
+    rc = LoadWAL(WalFile(WalDir(dbname_), log_nums[i]), log_nums[i]);
+    if (rc) return rc;
     log_number_ = log_nums[i] + 1;
   }
   return rc;
@@ -648,7 +854,7 @@ RC DB::LoadWALs(const deque<int64_t> &log_nums) {
  * @brief 加载预写日志，目前的策略是将每个日志写到 memtable 中, 如果发现大于
  * memtable 大小则刷盘，
  */
-RC DB::LoadWAL(string_view wal_file_path) {
+RC DB::LoadWAL(string_view wal_file_path, int64_t log_number) {
   MLog->trace("DB::LoadWAL");
   RC rc = OK;
   string record;
@@ -661,12 +867,12 @@ RC DB::LoadWAL(string_view wal_file_path) {
   /* 但在出现错误开始，后面的记录丢弃 */
   for (rc = wal_reader->ReadRecord(record); !rc;
        rc = wal_reader->ReadRecord(record)) {
-    string value;
-    MemKey memkey;
-    DecodeKVPair(record, memkey, value);
+    /* 每条记录都是一个完整的 batch，要么整体回放要么整体丢弃 */
+    WriteBatch batch;
+    if (rc = batch.SetData(record); rc) break;
     /* 如果没有 memtable 则创建 */
     if (!mem) mem = make_shared<MemTable>(*options_);
-    rc = mem->Put(memkey, value);
+    rc = mem->Write(batch);
     if (rc) break;
 
     /* 看 memtable 是否超额 需要落盘 */
@@ -687,7 +893,12 @@ RC DB::LoadWAL(string_view wal_file_path) {
     mem.reset();
   }
 
-  /* 全部落盘成功删除 wal */
+  /* 全部落盘成功，版本不再引用它之后删除 wal */
+  current_rev_->EraseLogNumber(log_number);
+  if (rc = WriteCurrentRev(&*current_rev_); rc) {
+    delete wal_reader;
+    return rc;
+  }
   wal_reader->Close();
   wal_reader->Drop();
   delete wal_reader;
@@ -727,10 +938,14 @@ RC DB::LoadMetaData() {
     return rc;
   }
 
+  /* 重放 wal 会生成新的 run */
+  next_run_id_ = current_rev_->GetMaxRunId() + 1;
+
   /* load current rev WAL */
   if (auto rc = LoadWALs(log_nums); rc) return rc;
 
   sequence_id_ = current_rev_->GetMaxSeq() + 1;
+  last_sequence_ = sequence_id_ - 1;
   return OK;
 }
 
@@ -3,19 +3,25 @@
 
 #include <atomic>
 #include <condition_variable>
+#include <deque>
+#include <set>
 #include <string>
+#include <unordered_map>
 #include "back_ground_worker.hpp"
 #include "cache.hpp"
 #include "mem_table.hpp"
 #include "monitor_logger.hpp"
 #include "options.hpp"
 #include "rc.hpp"
+#include "snapshot.hpp"
 #include "sstable.hpp"
+#include "write_batch.hpp"
 
 namespace adl {
 
 class Revision;
 class Level;
+struct Compaction;
 
 class DB {
  public:
@@ -30,29 +36,67 @@ class DB {
   RC Close();
   RC Put(string_view key, string_view value);
   RC Delete(string_view key);
+  /* 原子地写入一批 put/delete */
+  RC Write(const WriteBatch &batch);
 
   RC Get(string_view key, std::string &value);
+  RC Get(const ReadOptions &options, string_view key, std::string &value);
+
+  /* 获取当前数据的快照，用完后必须调用 ReleaseSnapshot */
+  const Snapshot *GetSnapshot();
+  void ReleaseSnapshot(const Snapshot *snapshot);
 
   void Debug();
   RC DebugSSTable(string_view oid);
 
  private:
-  RC Write(string_view key, string_view value, OpType op);
-  RC MaybeDoCompaction();
+  /* 组提交中排队等待的写者 */
+  struct Writer {
+    explicit Writer(const WriteBatch *batch)
+        : batch(batch), rc(OK), done(false) {}
+    const WriteBatch *batch;
+    RC rc;
+    bool done;
+    std::condition_variable cond;
+  };
+
+  /* 读取需要的内存表和版本，作为一个整体原子地发布，读者不需要持有锁 */
+  struct SuperVersion {
+    shared_ptr<MemTable> mem;
+    vector<shared_ptr<MemTable>> imms; /* 从旧到新 */
+    shared_ptr<Revision> current;
+  };
+
+  /* mem_ imms_ current_rev_ 任何一个改变后都需要调用，需要持有 mutex_ */
+  void InstallSuperVersion();
+
+  WriteBatch *BuildWriteGroup(Writer **last_writer);
+  RC MaybeDoCompaction(unique_lock<mutex> &lock);
+  void MaybeScheduleMajorCompaction();
   void DoCompaction();
-  RC DoMinorCompaction();
-  RC DoMajorCompaction();
+  /* 将一个不可变内存表落盘，可以在多个后台线程上并发进行 */
+  void DoMinorCompaction(shared_ptr<MemTable> imm);
+  RC InstallFlushResults(vector<shared_ptr<MemTable>> &installed);
+  RC DoMajorCompaction(unique_lock<mutex> &lock);
 
   RC GetSSTableReader(const string &oid, shared_ptr<SSTableReader> &sstable);
-  /* 将一层中所有 runs 进行合并，
-  创建一个新的 run 放到下一层 */
-  RC MergeRuns(const Level &level, FileMetaData **meta_data_pointer);
+  /* 将 compaction 的所有输入文件进行合并，
+  创建一个新的 run 放到下一层，run 按 target_file_size 切分成多个文件 */
+  RC MergeRuns(const Compaction &compaction, vector<FileMetaData *> &files);
+  /* 只合并 user key 在 [smallest, largest) 中的数据，nullptr 表示没有边界 */
+  RC DoSubCompaction(const Compaction &compaction, const string *smallest,
+                     const string *largest, int64_t run_id,
+                     vector<FileMetaData *> &files);
 
   RC BuildSSTable(const shared_ptr<adl::MemTable> &mem);
+  /* files 的所有权交给新版本 */
+  RC InstallSSTable(const vector<FileMetaData *> &files, int64_t log_number);
   RC FreezeMemTable();
   bool NeedCompactions();
   bool NeedMajorCompactions();
   bool NeedMinorCompactions();
+  /* 最旧的快照的序列号，没有快照时为最新的序列号，需要持有 mutex_ */
+  int64_t SmallestSnapshot();
 
   // RC InitCurrentRev();
   RC UpdateCurrentRev(Revision *rev);
@@ -62,13 +106,21 @@ class DB {
                      deque<int64_t> &log_nums);
   RC LoadMetaData();
   RC LoadWALs(const deque<int64_t> &log_nums);
-  RC LoadWAL(string_view wal_file_path);
+  RC LoadWAL(string_view wal_file_path, int64_t log_number);
 
   /* memtables */
   shared_ptr<MemTable> mem_;
-  shared_ptr<MemTable> imem_;
+  /* 等待落盘的不可变内存表，队首最旧 */
+  deque<shared_ptr<MemTable>> imms_;
+  /* 已经生成 sstable 但还没有安装的落盘结果，必须按 imms_ 的顺序安装，
+   * 否则较旧的数据可能出现在比它新的数据的上层 */
+  unordered_map<const MemTable *, vector<FileMetaData *>> flush_results_;
 
   std::atomic<int64_t> sequence_id_;
+  /* 对读可见的最大序列号，batch 整体写入 memtable 后才推进 */
+  std::atomic<int64_t> last_sequence_;
+  /* 还没有释放的快照的序列号，由 mutex_ 保护 */
+  multiset<int64_t> snapshots_;
 
   /* disk */
   string dbname_;
@@ -77,21 +129,36 @@ class DB {
   /* thread sync */
   mutex mutex_;
   std::condition_variable background_work_done_cond_;
+  /* 等待写入的写者队列，队首为 leader */
+  deque<Writer *> writers_;
+  /* leader 将一组写者的 batch 合并到这里 */
+  WriteBatch write_group_;
 
   /* back ground */
-  vector<Worker *> workers_;
+  /* 落盘和压实分别使用自己的线程池，落盘不会排在压实后面 */
+  unique_ptr<ThreadPool> flush_pool_;
+  unique_ptr<ThreadPool> compaction_pool_;
   RC save_backgound_rc_;
 
   /* state */
   std::atomic<bool> closed_;
-  bool is_compacting_;
+  /* 已经提交的 major compaction 任务数 */
+  int running_compactions_;
+  /* 正在参与 major compaction 的层 */
+  vector<bool> compacting_levels_;
 
   /* current revision */
   shared_ptr<Revision> current_rev_;
 
+  /* 读路径只访问这里 */
+  std::atomic<shared_ptr<SuperVersion>> super_version_;
+
   /* wal */
   std::atomic<int64_t> log_number_;
 
+  /* 每次落盘或合并输出的 run 的编号 */
+  std::atomic<int64_t> next_run_id_;
+
   /* cache */
   unique_ptr<LRUCache<string, shared_ptr<SSTableReader>, std::mutex>>
       table_cache_;
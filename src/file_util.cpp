@@ -612,10 +612,10 @@ std::string WritAbleFile::GetPath() { return file_path_; }
 std::ostream &operator<<(ostream &os, const FileMetaData &meta) {
   os << fmt::format(
       "@FileMetaData[ file_size={}, num_keys={}, max_seq={}, belong_to_level={}, "
-      "max_inner_key={} "
+      "run_id={}, max_inner_key={} "
       "min_inner_key={}, sha256={} ]\n",
       meta.file_size, meta.num_keys, meta.max_seq, meta.belong_to_level,
-      meta.max_inner_key, meta.min_inner_key, sha256_digit_to_hex(meta.sha256));
+      meta.run_id, meta.max_inner_key, meta.min_inner_key, sha256_digit_to_hex(meta.sha256));
   return os;
 }
 }  // namespace adl
\ No newline at end of file
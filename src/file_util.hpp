@@ -147,12 +147,15 @@ class RandomAccessFile {
  * @brief 文件元数据
  */
 struct FileMetaData {
-  FileMetaData() : file_size(0), num_keys(0), belong_to_level(-1), max_seq(0) {}
+  FileMetaData()
+      : file_size(0), num_keys(0), belong_to_level(-1), max_seq(0), run_id(0) {}
 
   size_t file_size;
   int num_keys;
   int belong_to_level;
   int64_t max_seq;
+  /* 同一次落盘或合并切分出的文件属于同一个 run */
+  int64_t run_id;
   MemKey max_inner_key;
   MemKey min_inner_key;
   unsigned char sha256[SHA256_DIGEST_LENGTH];
@@ -1,13 +1,31 @@
 #include "filter_block.hpp"
 #include <string.h>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
 #include "encode.hpp"
 #include "monitor_logger.hpp"
 #include "murmur3_hash.hpp"
+#include "options.hpp"
 
 namespace adl {
 
-RC BloomFilter::Keys2Block(const vector<string> &keys, string &result) {
-  int keys_len = (int)keys.size();
+uint64_t FilterAlgorithm::KeyHash(string_view key) {
+  /* 两个独立的 32 位哈希拼在一起，bloom 用来双哈希模拟多哈希 */
+  uint64_t h1 = murmur3_hash(0xe2c6928a, key.data(), key.size());
+  uint64_t h2 = murmur3_hash(0xbaea8a8f, key.data(), key.size());
+  return (h1 << 32) | h2;
+}
+
+RC FilterAlgorithm::Keys2Block(const vector<string> &keys, string &result) {
+  vector<uint64_t> hashes;
+  hashes.reserve(keys.size());
+  for (const auto &key : keys) hashes.push_back(KeyHash(key));
+  return Hashes2Block(hashes, result);
+}
+
+RC BloomFilter::Hashes2Block(const vector<uint64_t> &hashes, string &result) {
+  int keys_len = (int)hashes.size();
   int bitmap_bits_len =
       (keys_len * bits_per_key_ + 7) * 8; /* bitmap 长度（bits） */
   int init_len = (int)result.size();
@@ -17,10 +35,10 @@ RC BloomFilter::Keys2Block(const vector<string> &keys, string &result) {
   result.resize(init_len + bitmap_len);
   auto bitmap = &result[init_len];
 
-  for (const auto &key : keys) {
+  for (auto hash : hashes) {
     /* 双哈希模拟多哈希 （ leveldb 单哈希模拟多哈希）*/
-    auto h1 = murmur3_hash(0xe2c6928a, key.data(), key.size());
-    auto h2 = murmur3_hash(0xbaea8a8f, key.data(), key.size());
+    uint32_t h1 = (uint32_t)(hash >> 32);
+    uint32_t h2 = (uint32_t)hash;
 
     for (int j = 0; j < k_; j++) {
       auto h = h1 + j * h2;
@@ -46,11 +64,11 @@ BloomFilter::BloomFilter(int bits_per_key) : bits_per_key_(bits_per_key) {
   if (k_ > 30) k_ = 30;
 }
 
-bool BloomFilter::IsKeyExists(string_view key, string_view bitmap) {
+bool BloomFilter::IsHashExists(uint64_t hash, string_view bitmap) {
   int bitmap_bits_len = (int)bitmap.size() * 8;
 
-  auto h1 = murmur3_hash(0xe2c6928a, key.data(), key.size());
-  auto h2 = murmur3_hash(0xbaea8a8f, key.data(), key.size());
+  uint32_t h1 = (uint32_t)(hash >> 32);
+  uint32_t h2 = (uint32_t)hash;
   for (int j = 0; j < k_; j++) {
     auto h = h1 + j * h2;
     int bit_pos = (int)(h % bitmap_bits_len);
@@ -66,16 +84,95 @@ void BloomFilter::FilterInfo(string &info) {
   info.append((char *)&bits_per_key_, sizeof(int));
 }
 
+/* 块内 8 个字各自的乘法常数 */
+static const uint32_t kBlockedBloomSalt[8] = {
+    0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+    0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U};
+
+BlockedBloomFilter::BlockedBloomFilter(int bits_per_key)
+    : bits_per_key_(bits_per_key) {}
+
+uint64_t BlockedBloomFilter::KeyHash(string_view key) {
+  return murmur64_hash(0xe2c6928a, key.data(), key.size());
+}
+
+/* 哈希高 32 位乘以块数取高位，等价于均匀地映射到 [0, num_blocks) */
+static inline size_t BlockIndex(uint64_t hash, size_t num_blocks) {
+  return (size_t)(((hash >> 32) * num_blocks) >> 32);
+}
+
+RC BlockedBloomFilter::Hashes2Block(const vector<uint64_t> &hashes,
+                                    string &result) {
+  size_t bits = max<size_t>(hashes.size() * bits_per_key_, 1);
+  size_t num_blocks = (bits + kBlockBytes * 8 - 1) / (kBlockBytes * 8);
+  size_t init_len = result.size();
+  result.resize(init_len + num_blocks * kBlockBytes);
+  char *bitmap = &result[init_len];
+
+  for (auto hash : hashes) {
+    char *block = bitmap + BlockIndex(hash, num_blocks) * kBlockBytes;
+    for (int i = 0; i < 8; i++) {
+      uint32_t word;
+      memcpy(&word, block + i * sizeof(uint32_t), sizeof(uint32_t));
+      word |= 1U << (((uint32_t)hash * kBlockedBloomSalt[i]) >> 27);
+      memcpy(block + i * sizeof(uint32_t), &word, sizeof(uint32_t));
+    }
+  }
+  return OK;
+}
+
+bool BlockedBloomFilter::IsHashExists(uint64_t hash, string_view bitmap) {
+  size_t num_blocks = bitmap.size() / kBlockBytes;
+  /* 损坏的过滤器不能用来排除 key */
+  if (num_blocks == 0) return true;
+  const char *block =
+      bitmap.data() + BlockIndex(hash, num_blocks) * kBlockBytes;
+#ifdef __AVX2__
+  const __m256i salt = _mm256_loadu_si256((const __m256i *)kBlockedBloomSalt);
+  __m256i pos = _mm256_mullo_epi32(_mm256_set1_epi32((uint32_t)hash), salt);
+  pos = _mm256_srli_epi32(pos, 27);
+  __m256i mask = _mm256_sllv_epi32(_mm256_set1_epi32(1), pos);
+  __m256i words = _mm256_loadu_si256((const __m256i *)block);
+  /* mask 中的每一位在 words 中都被置位 */
+  return _mm256_testc_si256(words, mask);
+#else
+  for (int i = 0; i < 8; i++) {
+    uint32_t word;
+    memcpy(&word, block + i * sizeof(uint32_t), sizeof(uint32_t));
+    if (!(word & (1U << (((uint32_t)hash * kBlockedBloomSalt[i]) >> 27))))
+      return false;
+  }
+  return true;
+#endif
+}
+
+void BlockedBloomFilter::FilterInfo(string &info) {
+  info.append("bb:");
+  info.append((char *)&bits_per_key_, sizeof(int));
+}
+
+unique_ptr<FilterAlgorithm> NewFilterAlgorithm(const DBOptions &options) {
+  switch (options.filter_type) {
+    case BLOCKED_BLOOM_FILTER:
+      return make_unique<BlockedBloomFilter>(options.bits_per_key);
+    case BLOOM_FILTER:
+    default:
+      return make_unique<BloomFilter>(options.bits_per_key);
+  }
+}
+
 FilterBlockWriter::FilterBlockWriter(unique_ptr<FilterAlgorithm> &&method)
     : method_(std::move(method)) {}
 
 RC FilterBlockWriter::Update(string_view key) {
-  keys_.emplace_back(key);
+  uint64_t hash = method_->KeyHash(key);
+  /* 同一个 user key 的多个版本是相邻写入的 */
+  if (hashes_.empty() || hashes_.back() != hash) hashes_.push_back(hash);
   return OK;
 }
 
 RC FilterBlockWriter::Final(string &result) {
-  if (!keys_.empty()) Keys2Block();
+  if (!hashes_.empty()) Keys2Block();
 
   int offset_begin_offset = (int)buffer_.size();
   int offset_len = (int)offsets_.size();
@@ -103,8 +200,8 @@ RC FilterBlockWriter::Final(string &result) {
 
 RC FilterBlockWriter::Keys2Block() {
   offsets_.push_back((int)buffer_.size());
-  method_->Keys2Block(keys_, buffer_);
-  keys_.clear();
+  method_->Hashes2Block(hashes_, buffer_);
+  hashes_.clear();
   return OK;
 }
 
@@ -154,18 +251,27 @@ RC FilterBlockReader::Init(string_view filter_blocks) {
   return OK;
 }
 
-/* 目前只有 bf: */
+/* bf: 标准布隆过滤器，bb: 分块布隆过滤器 */
 RC FilterBlockReader::CreateFilterAlgorithm() {
   static const char *kBloomFilter = "bf";
+  static const char *kBlockedBloomFilter = "bb";
 
+  if (filter_info_.size() < 3 + sizeof(int)) return FILTER_BLOCK_ERROR;
   string_view type = filter_info_.substr(0, 2);
-  if (type != kBloomFilter) return FILTER_BLOCK_ERROR;
-
   int bits_per_key = 0;
   Decode32(&filter_info_[3], &bits_per_key);
-  MLog->info("FilterBlockReader Use BloomFilter algorithm, bits_per_key:{}",
-             bits_per_key);
-  method_ = std::make_unique<BloomFilter>(bits_per_key);
+  if (type == kBloomFilter) {
+    MLog->info("FilterBlockReader Use BloomFilter algorithm, bits_per_key:{}",
+               bits_per_key);
+    method_ = std::make_unique<BloomFilter>(bits_per_key);
+  } else if (type == kBlockedBloomFilter) {
+    MLog->info(
+        "FilterBlockReader Use BlockedBloomFilter algorithm, bits_per_key:{}",
+        bits_per_key);
+    method_ = std::make_unique<BlockedBloomFilter>(bits_per_key);
+  } else {
+    return FILTER_BLOCK_ERROR;
+  }
   return OK;
 }
 
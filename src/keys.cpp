@@ -32,8 +32,8 @@ int CmpKeyAndUserKey(string_view key, string_view user_key) {
 RC SaveResultIfUserKeyMatch(string_view rk, string_view rv, string_view tk,
                             string &dk, string &dv) {
   if (InnerKeyToUserKey(rk).compare(InnerKeyToUserKey(tk))) return NOT_FOUND;
-  if (InnerKeyOpType(rk) == OP_DELETE) return NOT_FOUND;
   dk.assign(rk.data(), rk.length());
+  if (InnerKeyOpType(rk) == OP_DELETE) return NOT_FOUND;
   dv.assign(rv.data(), rv.length());
   return OK;
 }
@@ -95,6 +95,10 @@ MemKey MemKey::NewMinMemKey(string_view uk) {
   return m;
 }
 
+MemKey MemKey::NewLookupKey(string_view uk, int64_t seq) {
+  return MemKey(uk, seq, OP_DELETE);
+}
+
 string NewMinInnerKey(string_view key) {
   MemKey mk = MemKey::NewMinMemKey(key);
   return mk.ToKey();
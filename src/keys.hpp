@@ -53,6 +53,8 @@ struct MemKey {
 
   /* user_key 绑定最大序列号作为查询的依据 */
   static MemKey NewMinMemKey(string_view uk);
+  /* 在 seq 处查询 uk 的 key，op 取最大值，保证排在同一 seq 的所有项之前 */
+  static MemKey NewLookupKey(string_view uk, int64_t seq);
 
   size_t Size() const { return user_key_.size() + 8 + 1; }
 };
@@ -64,6 +66,8 @@ OpType InnerKeyOpType(string_view inner_key);
 int CmpInnerKey(string_view k1, string_view k2);
 int CmpUserKeyOfInnerKey(string_view k1, string_view k2);
 int CmpKeyAndUserKey(string_view key, string_view user_key);
+/* 命中删除标记时返回 NOT_FOUND，但会把它的 inner key 写入 dk，
+ * 调用者可以据此知道这个 key 已经被删除 */
 RC SaveResultIfUserKeyMatch(string_view rk, string_view rv, string_view tk,
                                  string &dk, string &dv);
 string NewMinInnerKey(string_view key);
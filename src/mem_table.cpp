@@ -1,5 +1,6 @@
 #include "mem_table.hpp"
 #include <string.h>
+#include "encode.hpp"
 #include "file_util.hpp"
 #include "hash_util.hpp"
 #include "monitor_logger.hpp"
@@ -7,111 +8,118 @@
 namespace adl {
 
 RC MemTable::Put(const MemKey &key, string_view value) {
-  lock_guard<shared_mutex> lock(mu_);
-  if (key.op_type_ == OP_PUT)
-    table_[key] = value;
-  else if (key.op_type_ == OP_DELETE)
-    table_[key] = "";
+  PutNoLock(key, value);
+  return OK;
+}
 
+void MemTable::PutNoLock(const MemKey &key, string_view value) {
+  if (key.op_type_ == OP_DELETE) value = "";
+
+  /* 直接在 arena 中编码，避免额外的拷贝 */
+  int key_len = (int)key.Size();
+  int value_len = (int)value.size();
+  char *buf = arena_.Allocate(sizeof(int) * 2 + key_len + value_len);
+  char *p = buf;
+  Encode32(key_len, p);
+  p += sizeof(int);
+  memcpy(p, key.user_key_.data(), key.user_key_.size());
+  p += key.user_key_.size();
+  memcpy(p, &key.seq_, sizeof(int64_t));
+  p += sizeof(int64_t);
+  *p++ = (char)key.op_type_;
+  Encode32(value_len, p);
+  p += sizeof(int);
+  memcpy(p, value.data(), value_len);
+
+  table_->Insert(buf);
+  num_entries_.fetch_add(1, memory_order_relaxed);
   stat_.Update(key.Size(), value.size());
-  return OK;
 }
 
-RC MemTable::PutTeeWAL(const MemKey &key, string_view value) {
+RC MemTable::Write(const WriteBatch &batch) {
+  return batch.ForEach([&](const MemKey &key, string_view value) -> RC {
+    PutNoLock(key, value);
+    return OK;
+  });
+}
+
+RC MemTable::WriteTeeWAL(const WriteBatch &batch) {
   RC rc = OK;
-  /* 首先写到预写日志 wal */
+  /* 首先写到预写日志 wal，整个 batch 只占一条记录 */
   assert(wal_);
-  rc = wal_->AddRecord(EncodeKVPair(key, value));
+  rc = wal_->AddRecord(batch.Data());
   if (rc) return rc;
   if (options_->sync) {
     rc = wal_->Sync();
     if (rc) return rc;
   }
   /* 然后再写入内存表 memtable */
-  rc = Put(key, value);
-  return rc;
+  return Write(batch);
 }
+
 RC MemTable::Get(string_view key, string &value, int64_t seq) {
-  shared_lock<shared_mutex> lock(mu_);
-  return GetNoLock(key, value, seq);
+  RC rc = GetNoLock(key, value, seq);
+  return rc == KEY_DELETED ? NOT_FOUND : rc;
 }
 
 RC MemTable::GetNoLock(string_view key, string &value, int64_t seq) {
-  MemKey look_key(key, seq);
+  string lookup;
+  EncodeWithPreLen(lookup, MemKey::NewLookupKey(key, seq).ToKey());
 
-  auto iter = table_.lower_bound(look_key);
-  if (iter == table_.end()) return NOT_FOUND;
+  const char *entry = table_->Seek(lookup.data());
+  if (entry == nullptr) return NOT_FOUND;
 
-  if (key == iter->first.user_key_ &&
-      iter->first.op_type_ != OpType::OP_DELETE) {
-    value = iter->second;
-    return OK;
-  }
-  return NOT_FOUND;
+  string_view inner_key = EntryInnerKey(entry);
+  if (key != InnerKeyToUserKey(inner_key)) return NOT_FOUND;
+  if (InnerKeyOpType(inner_key) == OpType::OP_DELETE) return KEY_DELETED;
+  string_view v = EntryValue(entry);
+  value.assign(v.data(), v.size());
+  return OK;
 }
 
 /* 一般是 IMEMTABLE 进行 BUILD 不需要加锁 */
-RC MemTable::BuildSSTable(string_view dbname,
-                          FileMetaData **meta_data_pointer) {
+RC MemTable::BuildSSTable(string_view dbname, int64_t run_id,
+                          vector<FileMetaData *> &files) {
   MLog->info("memtable -> sstable");
+  /* 目前 minor compaction 生成的 sstable 就放在 l0 */
   int sstable_level = 0;
   string true_path = FileManager::FixDirName(dbname);
   dbname = true_path;
-  FileMetaData *meta_data = new FileMetaData;
-  int64_t max_seq = 0;
-
-  /* 一个新的 sstable writer */
-  auto sstable_ok = NewSSTableWriter(dbname, options_);
-  if (!sstable_ok) {
-    delete meta_data;
-    return NEW_SSTABLE_ERROR;
-  }
-  auto sstable = std::move(sstable_ok.value());
 
-  /* 向 sstable 写入 memtable 的所有数据 */
-  RC rc = ForEachNoLock([&](const MemKey &memkey, string_view value) -> RC {
-    if (max_seq < memkey.seq_) max_seq = memkey.seq_;
-    string key = memkey.ToKey();
-    return sstable->Add(key, value);
+  /* 向 sstable 写入 memtable 的所有数据，内存表中已经是 inner key 不需要再编码 */
+  SSTableSplitWriter writer(dbname, options_, sstable_level, run_id);
+  RC rc = table_->ForEach([&](const char *entry) -> RC {
+    return writer.Add(EntryInnerKey(entry), EntryValue(entry));
   });
   if (rc) return rc;
   /* 向 sstable 写入索引，过滤器等元数据 */
-  if (rc = sstable->Final(meta_data->sha256); rc) return rc;
-
-  MLog->info("sstable {} created", sstable->GetPath());
-
-  /* 填充元数据，之后用来更新索引数据 */
-  meta_data->file_size = sstable->GetFileSize();
-  meta_data->min_inner_key = table_.begin()->first;
-  meta_data->max_inner_key = table_.rbegin()->first;
-  meta_data->num_keys = (int)table_.size();
-  meta_data->max_seq = max_seq;
-  /* 目前 minor compaction 生成的 sstable 就放在 l0 */
-  meta_data->belong_to_level = sstable_level;
-  *meta_data_pointer = meta_data;
-  return OK;
+  return writer.Final(files);
 }
 
-/* 暂时用不加锁版本 */
 RC MemTable::ForEachNoLock(
     std::function<RC(const MemKey &key, string_view value)> &&func) {
-  for (auto iter = table_.begin(); iter != table_.end(); iter++) {
-    const MemKey &memkey = iter->first;
-    string_view value = iter->second;
-    auto rc = func(memkey, value);
-    if (rc) return rc;
-  }
-  return OK;
+  MemKey memkey;
+  return table_->ForEach([&](const char *entry) -> RC {
+    memkey.FromKey(EntryInnerKey(entry));
+    return func(memkey, EntryValue(entry));
+  });
 }
 
 MemTable::MemTable(const DBOptions &options)
-    : options_(&options), wal_(nullptr) {}
-
-MemTable::MemTable(const DBOptions &options, WAL *wal)
-    : options_(&options), wal_(wal) {}
+    : options_(&options),
+      table_(NewMemTableRep(options, &arena_)),
+      num_entries_(0),
+      wal_(nullptr),
+      log_number_(-1) {}
+
+MemTable::MemTable(const DBOptions &options, WAL *wal, int64_t log_number)
+    : options_(&options),
+      table_(NewMemTableRep(options, &arena_)),
+      num_entries_(0),
+      wal_(wal),
+      log_number_(log_number) {}
 
 size_t MemTable::GetMemTableSize() {
-  shared_lock<shared_mutex> lock(mu_);
   return stat_.Sum();
 }
 
@@ -128,5 +136,7 @@ RC MemTable::DropWAL() {
   return rc;
 }
 
-bool MemTable::Empty() { return table_.empty(); }
+bool MemTable::Empty() {
+  return num_entries_.load(memory_order_relaxed) == 0;
+}
 }  // namespace adl
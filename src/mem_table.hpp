@@ -2,15 +2,17 @@
 #define ADL_LSM_TREE_MEM_TABLE_H__
 
 #include <string.h>
+#include <atomic>
 #include <functional>
-#include <map>
 #include <memory>
-#include <mutex>
-#include <shared_mutex>
 #include <string>
+#include <vector>
+#include "arena.hpp"
 #include "keys.hpp"
+#include "mem_table_rep.hpp"
 #include "rc.hpp"
 #include "wal.hpp"
+#include "write_batch.hpp"
 
 namespace adl {
 
@@ -19,21 +21,31 @@ using namespace std;
 class FileMetaData;
 
 struct DBOptions;
+
+/**
+ * @brief 内存表，key 和 value 编码后存放在 Arena 中，由 MemTableRep 组织。
+ *
+ * 每一项的格式见 mem_table_rep.hpp，默认的跳表实现写入和读取都不加锁，
+ * 多个线程可以同时写入不同的 key。
+ */
 class MemTable {
  public:
   struct Stat {
     Stat() : keys_size_(0), values_size_(0) {}
     void Update(size_t key_size, size_t value_size) {
-      keys_size_ += key_size;
-      values_size_ += value_size;
+      keys_size_.fetch_add(key_size, memory_order_relaxed);
+      values_size_.fetch_add(value_size, memory_order_relaxed);
+    }
+    size_t Sum() const {
+      return keys_size_.load(memory_order_relaxed) +
+             values_size_.load(memory_order_relaxed);
     }
-    size_t Sum() { return keys_size_ + values_size_; }
-    size_t keys_size_;
-    size_t values_size_;
+    std::atomic<size_t> keys_size_;
+    std::atomic<size_t> values_size_;
   };
 
   MemTable(const DBOptions &options);
-  MemTable(const DBOptions &options, WAL *wal);
+  MemTable(const DBOptions &options, WAL *wal, int64_t log_number = -1);
   MemTable operator=(const MemTable &) = delete;
   MemTable(const MemTable &) = delete;
 
@@ -41,23 +53,35 @@ class MemTable {
     if (wal_) delete wal_;
   }
   RC Put(const MemKey &key, string_view value);
-  RC PutTeeWAL(const MemKey &key, string_view value);
+  /* 写入整个 batch，可以和其他写入并发进行 */
+  RC Write(const WriteBatch &batch);
+  /* 先将 batch 作为一条记录写入 wal，再写入内存表 */
+  RC WriteTeeWAL(const WriteBatch &batch);
 
   RC Get(string_view key, string &value, int64_t seq = INT64_MAX);
+  /* 最新版本是删除标记时返回 KEY_DELETED */
   RC GetNoLock(string_view key, string &value, int64_t seq = INT64_MAX);
   RC ForEachNoLock(
       std::function<RC(const MemKey &key, string_view value)> &&func);
-  RC BuildSSTable(string_view dbname, FileMetaData **meta_data_pointer);
+  /* 落盘到 L0，超过 target_file_size 时会切分成多个 sstable，同属于 run_id */
+  RC BuildSSTable(string_view dbname, int64_t run_id,
+                  vector<FileMetaData *> &files);
   size_t GetMemTableSize();
   RC DropWAL();
   bool Empty();
+  /* 对应的 wal 编号，落盘后需要从版本中移除 */
+  int64_t GetLogNumber() const { return log_number_; }
 
  private:
-  mutable shared_mutex mu_;
+  void PutNoLock(const MemKey &key, string_view value);
+
   const DBOptions *options_;
-  map<MemKey, string> table_;
+  Arena arena_;
+  unique_ptr<MemTableRep> table_;
+  std::atomic<int> num_entries_;
   Stat stat_; /* 整个内存表的状态 */
   WAL *wal_;
+  int64_t log_number_;
 };
 
 }  // namespace adl
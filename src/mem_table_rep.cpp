@@ -0,0 +1,183 @@
+#include "mem_table_rep.hpp"
+#include <algorithm>
+#include <mutex>
+#include <vector>
+#include "encode.hpp"
+#include "keys.hpp"
+#include "murmur3_hash.hpp"
+#include "options.hpp"
+#include "skiplist.hpp"
+
+namespace adl {
+
+string_view EntryInnerKey(const char *entry) {
+  int len;
+  Decode32(entry, &len);
+  return {entry + sizeof(int), (size_t)len};
+}
+
+string_view EntryValue(const char *entry) {
+  string_view inner_key = EntryInnerKey(entry);
+  const char *p = inner_key.data() + inner_key.size();
+  int len;
+  Decode32(p, &len);
+  return {p + sizeof(int), (size_t)len};
+}
+
+int EntryComparator::operator()(const char *a, const char *b) const {
+  return CmpInnerKey(EntryInnerKey(a), EntryInnerKey(b));
+}
+
+using EntrySkipList = SkipList<const char *, EntryComparator>;
+
+class SkipListRep : public MemTableRep {
+ public:
+  explicit SkipListRep(Arena *arena) : table_(EntryComparator(), arena) {}
+
+  void Insert(const char *entry) override { table_.Insert(entry); }
+
+  const char *Seek(const char *key) override {
+    EntrySkipList::Iterator iter(&table_);
+    iter.Seek(key);
+    return iter.Valid() ? iter.Key() : nullptr;
+  }
+
+  RC ForEach(const std::function<RC(const char *entry)> &func) override {
+    EntrySkipList::Iterator iter(&table_);
+    for (iter.SeekToFirst(); iter.Valid(); iter.Next())
+      if (auto rc = func(iter.Key()); rc) return rc;
+    return OK;
+  }
+
+ private:
+  EntrySkipList table_;
+};
+
+class HashSkipListRep : public MemTableRep {
+ public:
+  HashSkipListRep(Arena *arena, size_t prefix_len, size_t bucket_count)
+      : arena_(arena),
+        prefix_len_(prefix_len),
+        bucket_count_(bucket_count),
+        buckets_(new std::atomic<EntrySkipList *>[bucket_count]) {
+    for (size_t i = 0; i < bucket_count_; i++)
+      buckets_[i].store(nullptr, memory_order_relaxed);
+  }
+
+  void Insert(const char *entry) override {
+    auto &bucket = buckets_[BucketIndex(entry)];
+    EntrySkipList *table = bucket.load(memory_order_acquire);
+    if (table == nullptr) {
+      /* 桶在第一次写入时才创建，并发创建时输掉的一方只浪费一点 arena 空间 */
+      char *mem = arena_->Allocate(sizeof(EntrySkipList));
+      EntrySkipList *fresh = new (mem) EntrySkipList(EntryComparator(), arena_);
+      if (bucket.compare_exchange_strong(table, fresh, memory_order_acq_rel))
+        table = fresh;
+    }
+    table->Insert(entry);
+  }
+
+  /* 同一个 user key 的项一定在同一个桶中，只需要查找一个桶 */
+  const char *Seek(const char *key) override {
+    EntrySkipList *table =
+        buckets_[BucketIndex(key)].load(memory_order_acquire);
+    if (table == nullptr) return nullptr;
+    EntrySkipList::Iterator iter(table);
+    iter.Seek(key);
+    return iter.Valid() ? iter.Key() : nullptr;
+  }
+
+  /* 各个桶之间无序，需要整体排序一次，只在 BuildSSTable 时使用 */
+  RC ForEach(const std::function<RC(const char *entry)> &func) override {
+    vector<const char *> entries;
+    for (size_t i = 0; i < bucket_count_; i++) {
+      EntrySkipList *table = buckets_[i].load(memory_order_acquire);
+      if (table == nullptr) continue;
+      EntrySkipList::Iterator iter(table);
+      for (iter.SeekToFirst(); iter.Valid(); iter.Next())
+        entries.push_back(iter.Key());
+    }
+    EntryComparator cmp;
+    sort(entries.begin(), entries.end(),
+         [&](const char *a, const char *b) { return cmp(a, b) < 0; });
+    for (auto entry : entries)
+      if (auto rc = func(entry); rc) return rc;
+    return OK;
+  }
+
+ private:
+  size_t BucketIndex(const char *entry) const {
+    string_view user_key = InnerKeyToUserKey(EntryInnerKey(entry));
+    string_view prefix = user_key.substr(0, prefix_len_);
+    return murmur3_hash(0x9747b28c, prefix.data(), prefix.size()) %
+           bucket_count_;
+  }
+
+  Arena *const arena_;
+  const size_t prefix_len_;
+  const size_t bucket_count_;
+  unique_ptr<std::atomic<EntrySkipList *>[]> buckets_;
+};
+
+class VectorRep : public MemTableRep {
+ public:
+  VectorRep() : sorted_(true) {}
+
+  void Insert(const char *entry) override {
+    lock_guard<mutex> lock(mu_);
+    entries_.push_back(entry);
+    sorted_ = false;
+  }
+
+  /* 还没有排序时只能线性扫描，VECTOR_REP 本来就不适合读 */
+  const char *Seek(const char *key) override {
+    lock_guard<mutex> lock(mu_);
+    EntryComparator cmp;
+    if (sorted_) {
+      auto iter = lower_bound(
+          entries_.begin(), entries_.end(), key,
+          [&](const char *a, const char *b) { return cmp(a, b) < 0; });
+      return iter == entries_.end() ? nullptr : *iter;
+    }
+    const char *result = nullptr;
+    for (auto entry : entries_) {
+      if (cmp(entry, key) >= 0 && (result == nullptr || cmp(entry, result) < 0))
+        result = entry;
+    }
+    return result;
+  }
+
+  RC ForEach(const std::function<RC(const char *entry)> &func) override {
+    lock_guard<mutex> lock(mu_);
+    if (!sorted_) {
+      EntryComparator cmp;
+      sort(entries_.begin(), entries_.end(),
+           [&](const char *a, const char *b) { return cmp(a, b) < 0; });
+      sorted_ = true;
+    }
+    for (auto entry : entries_)
+      if (auto rc = func(entry); rc) return rc;
+    return OK;
+  }
+
+ private:
+  mutex mu_;
+  vector<const char *> entries_;
+  bool sorted_;
+};
+
+unique_ptr<MemTableRep> NewMemTableRep(const DBOptions &options,
+                                       Arena *arena) {
+  switch (options.mem_table_rep) {
+    case HASH_SKIPLIST_REP:
+      return make_unique<HashSkipListRep>(arena, options.hash_prefix_len,
+                                          options.hash_bucket_count);
+    case VECTOR_REP:
+      return make_unique<VectorRep>();
+    case SKIPLIST_REP:
+    default:
+      return make_unique<SkipListRep>(arena);
+  }
+}
+
+}  // namespace adl
@@ -0,0 +1,53 @@
+#ifndef ADL_LSM_TREE_MEM_TABLE_REP_H__
+#define ADL_LSM_TREE_MEM_TABLE_REP_H__
+
+#include <functional>
+#include <memory>
+#include <string_view>
+#include "arena.hpp"
+#include "rc.hpp"
+
+namespace adl {
+
+using namespace std;
+
+struct DBOptions;
+
+/**
+ * 内存表中的每一项都是 Arena 中一段编码好的内存：
+ * | inner key len 4Bytes | inner key | value len 4Bytes | value |
+ */
+string_view EntryInnerKey(const char *entry);
+string_view EntryValue(const char *entry);
+
+/* 按 inner key 比较两项 */
+struct EntryComparator {
+  int operator()(const char *a, const char *b) const;
+};
+
+/**
+ * @brief 内存表的底层存储，MemTable 负责编码，MemTableRep 只负责组织这些项。
+ *
+ * 不同实现适合不同的负载，由 DBOptions::mem_table_rep 选择：
+ * - SKIPLIST_REP 有序跳表，通用；
+ * - HASH_SKIPLIST_REP 按 user key 前缀分桶，每个桶一个跳表，点查只需要查一个桶；
+ * - VECTOR_REP 只追加不排序，在 BuildSSTable 时排序一次，适合写完不读的导入任务。
+ */
+class MemTableRep {
+ public:
+  virtual ~MemTableRep() = default;
+
+  /* 插入一项，不允许插入相等的项 */
+  virtual void Insert(const char *entry) = 0;
+  /* 返回第一个大于等于 key 的项，没有则返回 nullptr。
+   * 只保证在和 key 的 user key 相同的项中结果是正确的，用于点查。 */
+  virtual const char *Seek(const char *key) = 0;
+  /* 按顺序遍历所有项 */
+  virtual RC ForEach(const std::function<RC(const char *entry)> &func) = 0;
+};
+
+unique_ptr<MemTableRep> NewMemTableRep(const DBOptions &options,
+                                       Arena *arena);
+
+}  // namespace adl
+#endif  // ADL_LSM_TREE_MEM_TABLE_REP_H__
@@ -64,4 +64,54 @@ uint32_t murmur3_hash(uint32_t seed, const char *data, size_t len) {
   return seed;
 }
 
+uint64_t murmur64_hash(uint64_t seed, const char *data, size_t len) {
+  const uint64_t m = 0xc6a4a7935bd1e995ULL;
+  const int r = 47;
+  uint64_t h = seed ^ (len * m);
+
+  size_t len8 = len / sizeof(uint64_t);
+  for (size_t i = 0; i < len8; i++) {
+    uint64_t k = 0;
+    for (int j = 0; j < 8; j++)
+      k |= (uint64_t)(unsigned char)data[8 * i + j] << (8 * j);
+    k *= m;
+    k ^= k >> r;
+    k *= m;
+    h ^= k;
+    h *= m;
+  }
+
+  const unsigned char *tail =
+      (const unsigned char *)(data + len8 * sizeof(uint64_t));
+  switch (len & (sizeof(uint64_t) - 1)) {
+    case 7:
+      h ^= (uint64_t)tail[6] << 48;
+      /*-fallthrough*/
+    case 6:
+      h ^= (uint64_t)tail[5] << 40;
+      /*-fallthrough*/
+    case 5:
+      h ^= (uint64_t)tail[4] << 32;
+      /*-fallthrough*/
+    case 4:
+      h ^= (uint64_t)tail[3] << 24;
+      /*-fallthrough*/
+    case 3:
+      h ^= (uint64_t)tail[2] << 16;
+      /*-fallthrough*/
+    case 2:
+      h ^= (uint64_t)tail[1] << 8;
+      /*-fallthrough*/
+    case 1:
+      h ^= (uint64_t)tail[0];
+      h *= m;
+      break;
+  }
+
+  h ^= h >> r;
+  h *= m;
+  h ^= h >> r;
+  return h;
+}
+
 }  // namespace adl
\ No newline at end of file
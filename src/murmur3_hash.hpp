@@ -7,6 +7,8 @@ namespace adl {
 
 /*  https://en.wikipedia.org/wiki/MurmurHash#Algorithm */
 uint32_t murmur3_hash(uint32_t seed, const char *data, size_t len);
+/* MurmurHash64A，64 位的结果每一位都充分混合，供新的过滤器使用 */
+uint64_t murmur64_hash(uint64_t seed, const char *data, size_t len);
 
 }  // namespace adl
 
@@ -15,6 +15,27 @@
 
 namespace adl {
 
+class Snapshot;
+
+/* major compaction 的策略，见 doc/compaction.md */
+enum CompactionStyle {
+  COMPACTION_TIERING,  /* 每层可以有多个 run，一层满了整体合并到下一层 */
+  COMPACTION_LEVELING, /* L1 及以下每层只有一个 run，按 key 的重叠选择文件合并 */
+};
+
+/* 内存表的底层实现，见 mem_table_rep.hpp */
+enum MemTableRepType {
+  SKIPLIST_REP,      /* 有序跳表 */
+  HASH_SKIPLIST_REP, /* 按 key 前缀分桶的跳表，适合前缀集中的点查 */
+  VECTOR_REP,        /* 只追加的数组，flush 时排序，适合写完不读的导入 */
+};
+
+/* sstable 过滤器的算法，见 filter_block.hpp */
+enum FilterType {
+  BLOOM_FILTER,         /* 标准布隆过滤器，k 次探测分散在整个 bitmap 中 */
+  BLOCKED_BLOOM_FILTER, /* 一个 key 的所有探测都落在同一个 32 字节的块中 */
+};
+
 struct DBOptions {
   /* DB OPERATION */
   bool create_if_not_exists = false;
@@ -22,15 +43,33 @@ struct DBOptions {
   /* SSTABLE */
   /* 布隆过滤器 */
   int bits_per_key = 10;
+  FilterType filter_type = BLOOM_FILTER;
+  /* 每个数据块一个过滤器，点查时只读取索引指向的数据块对应的那一个，
+   * 否则整个 sstable 一个过滤器，可以在查索引之前过滤 */
+  bool partition_filters = false;
+  /* 落盘和压实的输出超过这个大小就切换到新的 sstable，只在 user key 变化处切分 */
+  size_t target_file_size = 1UL << 21; /* 2MB */
 
   /* MEMTABLE */
   /* 内存表最大大小，超过了则应该冻结内存表 */
   size_t mem_table_max_size = 1UL << 22; /* 4MB */
+  MemTableRepType mem_table_rep = SKIPLIST_REP;
+  /* HASH_SKIPLIST_REP 取 user key 的前几个字节分桶 */
+  size_t hash_prefix_len = 8;
+  size_t hash_bucket_count = 1UL << 14;
+  /* 最多有几个等待落盘的不可变内存表，超过了写入需要等待落盘 */
+  int max_immutable_memtables = 2;
 
   size_t block_cache_size = 1UL << 11; /* 2048 个 BLOCK */
 
   /* BACKGROUND */
-  int background_workers_number = 1;
+  /* 落盘线程池的大小，不可变内存表在这些线程上并发落盘，
+   * 和压实使用不同的线程池，不会排在耗时的 major compaction 后面 */
+  int max_background_flushes = 2;
+  /* 压实线程池的大小，不涉及相同层的 major compaction 可以同时进行 */
+  int max_background_compactions = 1;
+  /* 压实线程以较低的系统优先级运行，CPU 紧张时让给前台读写和落盘 */
+  bool lower_compaction_cpu_priority = false;
 
   /* LOG */
   const char *log_pattern = "[%Y-%m-%d %H:%M:%S.%e] [%l] [%n] %v";
@@ -42,7 +81,21 @@ struct DBOptions {
   bool sync = false;
 
   /* major compaction */
+  CompactionStyle compaction_style = COMPACTION_TIERING;
+  /* tiering 下每层的 run 数上限，leveling 下只用于 L0 */
   int level_files_limit = 4;
+  /* leveling 下 L1 的目标大小，之后每层乘以 level_size_multiplier */
+  size_t level1_max_bytes = 1UL << 24; /* 16MB */
+  int level_size_multiplier = 10;
+  /* 一次 major compaction 最多按 key 范围拆成几个子任务并行合并 */
+  int max_subcompactions = 1;
+  /* L0 文件数达到这个值时写入需要等待 major compaction 完成 */
+  int level0_stop_writes_trigger = 12;
+};
+
+struct ReadOptions {
+  /* 不为空时读取快照创建时的数据，否则读取最新的数据 */
+  const Snapshot *snapshot = nullptr;
 };
 
 }  // namespace adl
@@ -36,6 +36,8 @@ enum RC {
   BAD_FILE_PATH,
   BAD_CURRENT_FILE,
   NEW_SSTABLE_ERROR,
+  /* 找到的最新版本是删除标记，不需要再查更旧的数据 */
+  KEY_DELETED,
 };
 
 inline std::string_view strrc(RC rc) {
@@ -98,6 +100,8 @@ inline std::string_view strrc(RC rc) {
       return "bad current file";
     case NEW_SSTABLE_ERROR:
       return "new sstable error";
+    case KEY_DELETED:
+      return "key deleted";
     default:
       return "unknown error";
   }
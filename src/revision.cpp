@@ -1,6 +1,7 @@
 #include "revision.hpp"
 #include <fmt/core.h>
 #include <fmt/ostream.h>
+#include <algorithm>
 #include <fstream>
 #include <sstream>
 #include "db.hpp"
@@ -29,7 +30,12 @@ Level::Level(DB *db, int level) : Object(db), level_(level) {
 }
 
 Level::Level(const Level &rhs)
-    : Object(rhs.db_), level_(rhs.level_), files_meta_(rhs.files_meta_) {
+    : Object(rhs.db_),
+      level_(rhs.level_),
+      files_meta_(rhs.files_meta_),
+      sorted_files_(rhs.sorted_files_),
+      overlapping_pairs_(rhs.overlapping_pairs_),
+      files_by_seq_(rhs.files_by_seq_) {
   memcpy(&sha256_digit_, &rhs.sha256_digit_, SHA256_DIGEST_LENGTH);
   memcpy(&sha256_, &rhs.sha256_, sizeof(SHA256_CTX));
 }
@@ -38,6 +44,9 @@ Level &Level::operator=(Level &rhs) {
   if (this != &rhs) {
     level_ = rhs.level_;
     files_meta_ = rhs.files_meta_;
+    sorted_files_ = rhs.sorted_files_;
+    overlapping_pairs_ = rhs.overlapping_pairs_;
+    files_by_seq_ = rhs.files_by_seq_;
     sha256_ = rhs.sha256_;
     db_ = rhs.db_;
     memcpy(&sha256_digit_, &rhs.sha256_digit_, SHA256_DIGEST_LENGTH);
@@ -45,16 +54,62 @@ Level &Level::operator=(Level &rhs) {
   return *this;
 }
 
+bool Level::Overlap(const shared_ptr<FileMetaData> &a,
+                    const shared_ptr<FileMetaData> &b) {
+  return !(a->max_inner_key.user_key_ < b->min_inner_key.user_key_);
+}
+
 void Level::Insert(FileMetaData *file_meta) {
-  files_meta_.insert(shared_ptr<FileMetaData>(file_meta));
+  auto [iter, ok] = files_meta_.insert(shared_ptr<FileMetaData>(file_meta));
+  if (!ok) return;
+  /* 插入位置与 set 中的顺序一致，只需要更新新文件两侧相邻对的重叠计数 */
+  size_t pos = distance(files_meta_.begin(), iter);
+  auto &files = sorted_files_;
+  if (pos > 0 && pos < files.size())
+    overlapping_pairs_ -= Overlap(files[pos - 1], files[pos]);
+  if (pos > 0) overlapping_pairs_ += Overlap(files[pos - 1], *iter);
+  if (pos < files.size()) overlapping_pairs_ += Overlap(*iter, files[pos]);
+  files.insert(files.begin() + pos, *iter);
+
+  auto seq_pos = upper_bound(files_by_seq_.begin(), files_by_seq_.end(), *iter,
+                             [](const shared_ptr<FileMetaData> &a,
+                                const shared_ptr<FileMetaData> &b) {
+                               return a->max_seq > b->max_seq;
+                             });
+  files_by_seq_.insert(seq_pos, *iter);
 }
 
 void Level::Erase(FileMetaData *file_meta) {
-  if (auto iter = files_meta_.find(file_meta); iter != files_meta_.end())
-    files_meta_.erase(iter);
+  auto iter = files_meta_.find(file_meta);
+  if (iter == files_meta_.end()) return;
+  size_t pos = distance(files_meta_.begin(), iter);
+  auto &files = sorted_files_;
+  if (pos > 0) overlapping_pairs_ -= Overlap(files[pos - 1], files[pos]);
+  if (pos + 1 < files.size())
+    overlapping_pairs_ -= Overlap(files[pos], files[pos + 1]);
+  if (pos > 0 && pos + 1 < files.size())
+    overlapping_pairs_ += Overlap(files[pos - 1], files[pos + 1]);
+  files.erase(files.begin() + pos);
+  files_by_seq_.erase(find(files_by_seq_.begin(), files_by_seq_.end(), *iter));
+  files_meta_.erase(iter);
 }
+
 bool Level::Empty() const { return files_meta_.empty(); }
 
+bool Level::IsDisjoint() const { return overlapping_pairs_ == 0; }
+
+shared_ptr<FileMetaData> Level::FindFile(string_view key) const {
+  /* 第一个 max user key 不小于 key 的文件 */
+  auto iter = lower_bound(sorted_files_.begin(), sorted_files_.end(), key,
+                          [](const shared_ptr<FileMetaData> &f,
+                             string_view k) {
+                            return f->max_inner_key.user_key_ < k;
+                          });
+  if (iter == sorted_files_.end() || key < (*iter)->min_inner_key.user_key_)
+    return nullptr;
+  return *iter;
+}
+
 bool Level::HaveCheckSum() const {
   for (int i = 0; i < SHA256_DIGEST_LENGTH; i++) {
     if (sha256_digit_[i] != 0) return true;
@@ -62,12 +117,22 @@ bool Level::HaveCheckSum() const {
   return false;
 }
 
-int Level::TotalFileSize() const {
-  int total_size = 0;
-  for (auto &file_meta : files_meta_) total_size += (int)file_meta->file_size;
+int64_t Level::TotalFileSize() const {
+  int64_t total_size = 0;
+  for (auto &file_meta : files_meta_) total_size += file_meta->file_size;
   return total_size;
 }
 
+void Level::GetOverlappingFiles(string_view smallest, string_view largest,
+                                vector<shared_ptr<FileMetaData>> &files) const {
+  for (auto &file_meta : files_meta_) {
+    if (file_meta->max_inner_key.user_key_ < smallest ||
+        file_meta->min_inner_key.user_key_ > largest)
+      continue;
+    files.push_back(file_meta);
+  }
+}
+
 int Level::GetLevel() const { return level_; }
 
 RC Level::BuildFile(string_view dbname) {
@@ -86,9 +151,11 @@ RC Level::BuildFile(string_view dbname) {
   /* file num 4B */
   temp_level_file->Append({(char *)&file_num, sizeof(int)});
   SHA256_Update(&sha256_, &file_num, sizeof(int));
-  /* file meta [num_keys, min-key-size, min-key, max-key-size, max-key] */
+  /* file meta [num_keys, max_seq, run_id, min-key-size, min-key,
+   * max-key-size, max-key] */
   for (auto &file : files_meta_) {
     int64_t max_seq = file->max_seq;
+    int64_t run_id = file->run_id;
     int num_keys = file->num_keys;
     string min_inner_key = file->min_inner_key.ToKey();
     int min_inner_key_size = (int)min_inner_key.size();
@@ -105,6 +172,8 @@ RC Level::BuildFile(string_view dbname) {
     SHA256_Update(&sha256_, (char *)&num_keys, sizeof(int));
     temp_level_file->Append({(char *)&max_seq, sizeof(int64_t)});
     SHA256_Update(&sha256_, (char *)&max_seq, sizeof(int64_t));
+    temp_level_file->Append({(char *)&run_id, sizeof(int64_t)});
+    SHA256_Update(&sha256_, (char *)&run_id, sizeof(int64_t));
     temp_level_file->Append({(char *)&min_inner_key_size, sizeof(int)});
     SHA256_Update(&sha256_, (char *)&min_inner_key_size, sizeof(int));
     temp_level_file->Append(min_inner_key);
@@ -129,6 +198,19 @@ RC Level::BuildFile(string_view dbname) {
 
 int Level::FilesCount() const { return (int)files_meta_.size(); }
 
+int Level::RunsCount() const {
+  set<int64_t> run_ids;
+  for (auto &file_meta : files_meta_) run_ids.insert(file_meta->run_id);
+  return (int)run_ids.size();
+}
+
+int64_t Level::GetMaxRunId() const {
+  int64_t max_run_id = 0;
+  for (auto &file_meta : files_meta_)
+    max_run_id = max(max_run_id, file_meta->run_id);
+  return max_run_id;
+}
+
 void Level::SetLevel(int level) { level_ = level; }
 
 RC Level::LoadFromFile(string_view dbname, string_view lvl_sha_hex) {
@@ -172,12 +254,14 @@ RC Level::LoadFromFile(string_view dbname, string_view lvl_sha_hex) {
   MLog->info("level {} file num {}", level, file_num);
 
   /* 2. file meta
-  [num_keys, min-key-size, min-key, max-key-size, max-key, sstable-sha ] */
+  [num_keys, max_seq, run_id, min-key-size, min-key, max-key-size, max-key,
+  sstable-sha ] */
   level_file->Read(sizeof(int) * 2, file_size - sizeof(int) * 2, buffer);
   const char *cur_pointer = buffer.data();
   const char *end_pointer = buffer.data() + buffer.size();
   for (int i = 0; i < file_num; i++) {
     int64_t max_seq;
+    int64_t run_id;
     int num_keys;
     int min_key_len;
     int max_key_len;
@@ -203,6 +287,15 @@ RC Level::LoadFromFile(string_view dbname, string_view lvl_sha_hex) {
     cur_pointer += sizeof(int64_t);
     MLog->debug("max_seq {}", max_seq);
 
+    if (cur_pointer + sizeof(int64_t) > end_pointer) {
+      rc = BAD_LEVEL;
+      return rc;
+    }
+
+    Decode64(cur_pointer, &run_id);
+    cur_pointer += sizeof(int64_t);
+    MLog->debug("run_id {}", run_id);
+
     if (cur_pointer + sizeof(int) > end_pointer) {
       rc = BAD_LEVEL;
       return rc;
@@ -249,6 +342,7 @@ RC Level::LoadFromFile(string_view dbname, string_view lvl_sha_hex) {
     file_meta->belong_to_level = level_;
     file_meta->num_keys = num_keys;
     file_meta->max_seq = max_seq;
+    file_meta->run_id = run_id;
     file_meta->min_inner_key.FromKey(min_key);
     file_meta->max_inner_key.FromKey(max_key);
     if (rc = FileManager::GetFileSize(file_meta->GetSSTablePath(dbname),
@@ -264,7 +358,7 @@ RC Level::LoadFromFile(string_view dbname, string_view lvl_sha_hex) {
 
 RC Level::Get(string_view key, string &value, int64_t seq) {
   RC rc = NOT_FOUND;
-  MemKey mk(key, seq);
+  MemKey mk = MemKey::NewLookupKey(key, seq);
   string inner_key = mk.ToKey();
   string result_key;
   string result_value;
@@ -276,15 +370,8 @@ RC Level::Get(string_view key, string &value, int64_t seq) {
   }
   MLog->debug("{} file in level {}", files_meta_.size(), GetOid());
 
-  for (auto iter = files_meta_.rbegin(); iter != files_meta_.rend(); ++iter) {
-    auto &file_meta = *iter;
-    /* 不在范围内的 key 不考虑 */
-    if ((mk < file_meta->min_inner_key &&
-         mk.user_key_ != file_meta->min_inner_key.user_key_) ||
-        file_meta->max_inner_key < mk) {
-      MLog->info("Get key {} skip {}", key, file_meta->GetOid());
-      continue;
-    }
+  /* 查找一个文件，命中的结果与之前的结果比较，保留 key 最小的项 */
+  auto probe = [&](const shared_ptr<FileMetaData> &file_meta) -> RC {
     shared_ptr<SSTableReader> sstable;
     rc = db_->GetSSTableReader(sha256_digit_to_hex(file_meta->sha256), sstable);
     if (rc) {
@@ -292,21 +379,48 @@ RC Level::Get(string_view key, string &value, int64_t seq) {
       return rc;
     }
 
-    /* TODO(adl): use seq 实现 snapshot read */
-
+    result_key.clear();
     rc = sstable->Get(inner_key, result_key, result_value);
-    if (rc == NOT_FOUND) {
+    /* 命中删除标记时 result_key 不为空，它同样参与新旧比较 */
+    if (rc == NOT_FOUND && result_key.empty()) {
       MLog->info("Get key {} miss from {}", key, file_meta->GetOid());
-      continue;
+      return OK;
+    }
+    if (rc && rc != NOT_FOUND) {
+      MLog->error("Get key {} from {} failed: {}", key, file_meta->GetOid(),
+                  strrc(rc));
+      return rc;
     }
     if (min_key.empty() || CmpInnerKey(result_key, min_key) < 0) {
       min_key = result_key;
       value = result_value;
     }
-    /* 在 tiering 层内必须考虑扫描所有的 sstable
-    选出 key 最小的项返回 */
+    return OK;
+  };
+
+  if (IsDisjoint()) {
+    /* 文件互不重叠，同一个 user key 的所有版本只会在一个文件中 */
+    auto file_meta = FindFile(key);
+    if (!file_meta) return NOT_FOUND;
+    if (rc = probe(file_meta); rc) return rc;
+  } else {
+    /* 在 tiering 层内或 L0 必须考虑扫描所有重叠的 sstable
+    选出 key 最小的项返回。按 max_seq 从大到小查找，已经找到的版本比剩下
+    文件中所有的版本都新时就可以停止 */
+    for (auto &file_meta : files_by_seq_) {
+      if (!min_key.empty() && file_meta->max_seq < InnerKeySeq(min_key)) break;
+      /* 不在范围内的 key 不考虑 */
+      if ((mk < file_meta->min_inner_key &&
+           mk.user_key_ != file_meta->min_inner_key.user_key_) ||
+          file_meta->max_inner_key < mk) {
+        MLog->info("Get key {} skip {}", key, file_meta->GetOid());
+        continue;
+      }
+      if (rc = probe(file_meta); rc) return rc;
+    }
   }
-  return min_key.empty() ? NOT_FOUND : OK;
+  if (min_key.empty()) return NOT_FOUND;
+  return InnerKeyOpType(min_key) == OP_DELETE ? KEY_DELETED : OK;
 }
 
 int64_t Level::GetMaxSeq() {
@@ -392,8 +506,8 @@ RC Revision::Get(string_view key, std::string &value, int64_t seq) {
   RC rc = NOT_FOUND;
   for (int i = 0; i < 5 && rc == NOT_FOUND; ++i) {
     if (levels_[i].Empty()) continue;
-    rc = levels_[i].Get(key, value);
-    /* 如果在某一层找到了则可以直接返回 */
+    rc = levels_[i].Get(key, value, seq);
+    /* 如果在某一层找到了或者被删除了则可以直接返回 */
     if (rc == NOT_FOUND)
       MLog->info("Get key {} miss in level {}", key, i);
     else if (rc == OK)
@@ -402,21 +516,160 @@ RC Revision::Get(string_view key, std::string &value, int64_t seq) {
   return rc;
 }
 
-int Revision::PickBestCompactionLevel() {
+int Revision::PickBestCompactionLevel(const vector<bool> &busy_levels) {
   int levels_size = (int)levels_.size();
   assert(levels_size == 5);
+  auto busy = [&](int i) {
+    return (i < (int)busy_levels.size() && busy_levels[i]) ||
+           (i + 1 < (int)busy_levels.size() && busy_levels[i + 1]);
+  };
+
+  /* 选分数最高的层，总是先压实 L0 的话，落盘很快时更深的层会一直排不上 */
+  int best_level = -1;
+  double best_score = 1;
+  for (int i = 0; i < levels_size - 1; i++) {
+    if (busy(i)) continue;
+    double score = CompactionScore(i);
+    if (score > best_score) {
+      best_score = score;
+      best_level = i;
+    }
+  }
+  return best_level;
+}
+
+int64_t Revision::MaxBytesForLevel(int level) const {
+  int64_t bytes = (int64_t)db_->options_->level1_max_bytes;
+  for (int i = 1; i < level; i++) bytes *= db_->options_->level_size_multiplier;
+  return bytes;
+}
+
+double Revision::CompactionScore(int level) const {
+  /* tiering 和 L0 的 run 之间会重叠，读取需要查找每个 run，所以按 run 数计算 */
+  if (db_->options_->compaction_style == COMPACTION_TIERING || level == 0)
+    return levels_[level].RunsCount() /
+           (double)db_->options_->level_files_limit;
+  return levels_[level].TotalFileSize() / (double)MaxBytesForLevel(level);
+}
+
+/* 按 min key 排序后相邻的文件不重叠，则所有文件都互不重叠 */
+static bool HasOverlappingFiles(vector<shared_ptr<FileMetaData>> files) {
+  sort(files.begin(), files.end(), [](const auto &a, const auto &b) {
+    return a->min_inner_key.user_key_ < b->min_inner_key.user_key_;
+  });
+  for (size_t i = 1; i < files.size(); i++)
+    if (files[i]->min_inner_key.user_key_ <=
+        files[i - 1]->max_inner_key.user_key_)
+      return true;
+  return false;
+}
+
+bool Revision::PickCompaction(Compaction *compaction,
+                              const vector<bool> &busy_levels) {
+  int level = PickBestCompactionLevel(busy_levels);
+  if (level == -1) return false;
+  compaction->level = level;
+  auto &inputs = compaction->inputs;
+  const auto &files = levels_[level].GetSSTableFilesMeta();
+
+  /* tiering 将整层的所有 run 合并成下一层的一个新 run */
+  if (db_->options_->compaction_style == COMPACTION_TIERING) {
+    inputs[0].assign(files.begin(), files.end());
+    compaction->bottommost = IsBottommost(*compaction);
+    return true;
+  }
 
-  for (int i = 0; i < levels_size - 1; i++)
-    if (levels_[i].FilesCount() > db_->options_->level_files_limit) return i;
+  if (level == 0) {
+    /* 从最旧的文件开始，加入所有和已选文件重叠的 L0 文件。
+     * 留在 L0 的文件和选中的文件互不重叠，不会打乱新旧顺序 */
+    auto oldest = min_element(files.begin(), files.end(),
+                              [](const auto &a, const auto &b) {
+                                return a->run_id < b->run_id;
+                              });
+    inputs[0] = {*oldest};
+    string_view smallest = (*oldest)->min_inner_key.user_key_;
+    string_view largest = (*oldest)->max_inner_key.user_key_;
+    for (bool grown = true; grown;) {
+      grown = false;
+      for (auto &file : files) {
+        string_view min_key = file->min_inner_key.user_key_;
+        string_view max_key = file->max_inner_key.user_key_;
+        if (max_key < smallest || min_key > largest ||
+            find(inputs[0].begin(), inputs[0].end(), file) != inputs[0].end())
+          continue;
+        inputs[0].push_back(file);
+        smallest = min(smallest, min_key);
+        largest = max(largest, max_key);
+        grown = true;
+      }
+    }
+  } else {
+    /* 选择和下一层重叠的数据相对自身大小最少的文件，写放大最小 */
+    double best_ratio = 0;
+    for (auto &file : files) {
+      vector<shared_ptr<FileMetaData>> overlaps;
+      levels_[level + 1].GetOverlappingFiles(file->min_inner_key.user_key_,
+                                             file->max_inner_key.user_key_,
+                                             overlaps);
+      int64_t overlap_bytes = 0;
+      for (auto &overlap : overlaps) overlap_bytes += overlap->file_size;
+      double ratio = overlap_bytes / (double)max(file->file_size, (size_t)1);
+      if (inputs[0].empty() || ratio < best_ratio) {
+        best_ratio = ratio;
+        inputs[0] = {file};
+      }
+    }
+  }
 
-  return -1;
+  /* 下一层中和输入的 key 范围重叠的文件都要参与合并，保证下一层不重叠 */
+  string_view smallest = inputs[0].front()->min_inner_key.user_key_;
+  string_view largest = inputs[0].front()->max_inner_key.user_key_;
+  for (auto &file : inputs[0]) {
+    smallest = min(smallest, string_view(file->min_inner_key.user_key_));
+    largest = max(largest, string_view(file->max_inner_key.user_key_));
+  }
+  levels_[level + 1].GetOverlappingFiles(smallest, largest, inputs[1]);
+  compaction->trivial_move =
+      inputs[1].empty() && !HasOverlappingFiles(inputs[0]);
+  compaction->bottommost = IsBottommost(*compaction);
+  return true;
+}
+
+bool Revision::IsBottommost(const Compaction &compaction) const {
+  auto &inputs = compaction.inputs;
+  string_view smallest = inputs[0].front()->min_inner_key.user_key_;
+  string_view largest = inputs[0].front()->max_inner_key.user_key_;
+  for (auto &files : inputs) {
+    for (auto &file : files) {
+      smallest = min(smallest, string_view(file->min_inner_key.user_key_));
+      largest = max(largest, string_view(file->max_inner_key.user_key_));
+    }
+  }
+  for (int i = compaction.OutputLevel(); i < (int)levels_.size(); i++) {
+    vector<shared_ptr<FileMetaData>> overlaps;
+    levels_[i].GetOverlappingFiles(smallest, largest, overlaps);
+    for (auto &file : overlaps)
+      if (i != compaction.OutputLevel() ||
+          find(inputs[1].begin(), inputs[1].end(), file) == inputs[1].end())
+        return false;
+  }
+  return true;
 }
 void Revision::PushLogNumber(int64_t num) { log_nums_.push_back(num); }
 
-void Revision::PopLogNumber() { log_nums_.pop_front(); }
+void Revision::EraseLogNumber(int64_t num) {
+  auto iter = find(log_nums_.begin(), log_nums_.end(), num);
+  if (iter != log_nums_.end()) log_nums_.erase(iter);
+}
 
 const std::deque<int64_t> &Revision::GetLogNumbers() const { return log_nums_; }
 
+int64_t Revision::GetMaxRunId() const {
+  int64_t max_run_id = 0;
+  for (auto &level : levels_) max_run_id = max(max_run_id, level.GetMaxRunId());
+  return max_run_id;
+}
+
 int64_t Revision::GetMaxSeq() {
   int64_t maxseq = 0;
   for (int i = 0; i < levels_.size(); i++)
@@ -55,18 +55,32 @@ struct FileMetaDataCompare {
     return *a < *b;
   }
 };
+/* 一次 major compaction 的输入，合并结果放到 level + 1 层 */
+struct Compaction {
+  int level = -1;
+  /* inputs[0] 是 level 层参与合并的文件，inputs[1] 是 level + 1 层与之重叠的文件 */
+  vector<shared_ptr<FileMetaData>> inputs[2];
+  /* 输入文件互不重叠且下一层没有重叠的文件，只需要把元数据移到下一层 */
+  bool trivial_move = false;
+  /* 输出是这个 key 范围最底层的数据，可以丢弃删除标记 */
+  bool bottommost = false;
+  /* 序列号不大于它的版本对所有读者可见，更旧的版本可以丢弃 */
+  int64_t smallest_snapshot = INT64_MAX;
+  int OutputLevel() const { return level + 1; }
+};
+
 /**
  * @brief Level 对象
   Level Format:
 
   | Level  4Bytes   |   FileNum   4Bytes|
-  | min-key len | min-key | max-key len  | max-key | SHA             |
-  |------------| ------- |-------------- | ------- | --------------- |
-  |            | adl     |               | alskdj  | `<sstable-sha>` |
-  |            | basld   |               | caslkdj | `<sstable-sha>` |
-  |            | esakld  |               | faslkdj | `<sstable-sha>` |
-  |            | fjaskl  |               | qeku    | `<sstable-sha>` |
-  |            | ylyly   |               | zzzz    | `<sstable-sha>` |
+  | num keys | max seq | run id | min-key len | min-key | max-key len  | max-key | SHA             |
+  |----------|---------|--------|------------| ------- |-------------- | ------- | --------------- |
+  |          |         |        |            | adl     |               | alskdj  | `<sstable-sha>` |
+  |          |         |        |            | basld   |               | caslkdj | `<sstable-sha>` |
+  |          |         |        |            | esakld  |               | faslkdj | `<sstable-sha>` |
+  |          |         |        |            | fjaskl  |               | qeku    | `<sstable-sha>` |
+  |          |         |        |            | ylyly   |               | zzzz    | `<sstable-sha>` |
 
 
   除了 L0 可能会出现 OverLap，其它层都是按照 min-key 排序的
@@ -96,23 +110,46 @@ class Level : public Object {
   void Erase(FileMetaData *file_meta);
   bool Empty() const;
   int FilesCount() const;
+  /* 一个 run 可能被切分成多个文件，tiering 按 run 计数 */
+  int RunsCount() const;
+  int64_t GetMaxRunId() const;
   int GetLevel() const;
   void SetLevel(int level);
   bool HaveCheckSum() const;
-  int TotalFileSize() const;
+  int64_t TotalFileSize() const;
   int64_t GetMaxSeq();
+  /* user key 范围 [smallest, largest] 与之重叠的文件 */
+  void GetOverlappingFiles(string_view smallest, string_view largest,
+                           vector<shared_ptr<FileMetaData>> &files) const;
   const set<shared_ptr<FileMetaData>, FileMetaDataCompare>
       &GetSSTableFilesMeta() const;
+  /* 文件之间的 user key 范围互不重叠，读取时只需要查一个文件 */
+  bool IsDisjoint() const;
   void Clear() {
     Object::Clear();
     files_meta_.clear();
+    sorted_files_.clear();
+    overlapping_pairs_ = 0;
+    files_by_seq_.clear();
   }
 
   friend ostream &operator<<(ostream &os, const Level &level);
 
  private:
+  /* 相邻的两个文件 user key 范围是否重叠 */
+  static bool Overlap(const shared_ptr<FileMetaData> &a,
+                      const shared_ptr<FileMetaData> &b);
+  /* 不重叠的层里二分查找可能包含 key 的文件 */
+  shared_ptr<FileMetaData> FindFile(string_view key) const;
+
   /* 文件元数据 */
   set<shared_ptr<FileMetaData>, FileMetaDataCompare> files_meta_;
+  /* 与 files_meta_ 顺序相同的连续数组，用于二分查找 */
+  vector<shared_ptr<FileMetaData>> sorted_files_;
+  /* sorted_files_ 中相邻且重叠的文件对数，为 0 时整层不重叠 */
+  int overlapping_pairs_ = 0;
+  /* 按 max_seq 从大到小排列，重叠的层按这个顺序查找，可以提前结束 */
+  vector<shared_ptr<FileMetaData>> files_by_seq_;
   /* 第几层 */
   int level_;
 };
@@ -147,13 +184,25 @@ class Revision : public Object {
 
   void SetLevel(int level, Level *v);
   void PushLogNumber(int64_t num);
-  void PopLogNumber();
+  /* 移除一个已经落盘的 wal 编号，不存在则忽略 */
+  void EraseLogNumber(int64_t num);
   const deque<int64_t> &GetLogNumbers() const;
   int64_t GetMaxSeq();
-  int PickBestCompactionLevel();
+  int64_t GetMaxRunId() const;
+  /* 需要进行 major compaction 的层，没有则返回 -1。
+   * busy_levels 中正在压实的层和它的下一层都不会被选中 */
+  int PickBestCompactionLevel(const vector<bool> &busy_levels);
+  /* 选出下一次 major compaction 的输入，没有需要压实的层则返回 false */
+  bool PickCompaction(Compaction *compaction, const vector<bool> &busy_levels);
   friend ostream &operator<<(ostream &os, const Revision &rev);
 
  private:
+  /* 每层的压实分数，大于 1 说明需要压实 */
+  double CompactionScore(int level) const;
+  int64_t MaxBytesForLevel(int level) const;
+  /* 输出层和更深的层中，除了输入文件以外没有和输入的 key 范围重叠的文件 */
+  bool IsBottommost(const Compaction &compaction) const;
+
   /* 层级 */
   vector<Level> levels_;
   /* 不需要持久化到 revsion file;而是持久化到 current file */
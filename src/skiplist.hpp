@@ -0,0 +1,243 @@
+#ifndef ADL_LSM_TREE_SKIPLIST_H__
+#define ADL_LSM_TREE_SKIPLIST_H__
+
+#include <atomic>
+#include <cassert>
+#include <new>
+#include <random>
+#include "arena.hpp"
+
+namespace adl {
+
+using namespace std;
+
+/**
+ * @brief 无锁跳表，节点分配在 Arena 中，只插入不删除。
+ *
+ * 插入：先自顶向下找到每一层的前驱和后继，再自底向上用 CAS 把新节点链接进去，
+ * CAS 失败说明这一层有并发插入，从原来的前驱开始重新寻找位置即可。
+ * 节点从不删除，所以找到的前驱始终小于新节点。
+ * 读取：不加任何锁，节点总是先链接进底层，读者看到的底层链表始终有序。
+ *
+ * Comparator 返回 <0, 0, >0，不允许插入相等的 key。
+ */
+template <typename K, class Comparator>
+class SkipList {
+ private:
+  struct Node;
+
+ public:
+  SkipList(Comparator cmp, Arena *arena);
+  SkipList(const SkipList &) = delete;
+  SkipList &operator=(const SkipList &) = delete;
+
+  /* 可以多个线程并发调用 */
+  void Insert(const K &key);
+  bool Contains(const K &key) const;
+
+  class Iterator {
+   public:
+    explicit Iterator(const SkipList *list) : list_(list), node_(nullptr) {}
+    bool Valid() const { return node_ != nullptr; }
+    const K &Key() const {
+      assert(Valid());
+      return node_->key;
+    }
+    void Next() {
+      assert(Valid());
+      node_ = node_->Next(0);
+    }
+    void Prev() {
+      assert(Valid());
+      node_ = list_->FindLessThan(node_->key);
+      if (node_ == list_->head_) node_ = nullptr;
+    }
+    /* 定位到第一个大于等于 target 的节点 */
+    void Seek(const K &target) { node_ = list_->FindGreaterOrEqual(target); }
+    void SeekToFirst() { node_ = list_->head_->Next(0); }
+    void SeekToLast() {
+      node_ = list_->FindLast();
+      if (node_ == list_->head_) node_ = nullptr;
+    }
+
+   private:
+    const SkipList *list_;
+    Node *node_;
+  };
+
+ private:
+  static constexpr int max_level_ = 12;
+  static constexpr unsigned int branching_ = 4;
+
+  int GetMaxHeight() const { return max_height_.load(memory_order_relaxed); }
+  Node *NewNode(const K &key, int height);
+  int RandomHeight();
+  /* 返回第一个大于等于 key 的节点 */
+  Node *FindGreaterOrEqual(const K &key) const;
+  /* 返回最后一个小于 key 的节点，没有则返回 head_ */
+  Node *FindLessThan(const K &key) const;
+  Node *FindLast() const;
+  /* 从 before 开始在 level 层找到 key 的前驱和后继 */
+  void FindSpliceForLevel(const K &key, Node *before, int level,
+                          Node **out_prev, Node **out_next) const;
+
+  Comparator const compare_;
+  Arena *const arena_;
+  Node *const head_;
+  std::atomic<int> max_height_;
+};
+
+template <typename K, class Comparator>
+struct SkipList<K, Comparator>::Node {
+  explicit Node(const K &k) : key(k) {}
+
+  K const key;
+
+  Node *Next(int n) { return next_[n].load(memory_order_acquire); }
+  void SetNext(int n, Node *x) { next_[n].store(x, memory_order_release); }
+  void NoBarrierSetNext(int n, Node *x) {
+    next_[n].store(x, memory_order_relaxed);
+  }
+  bool CASNext(int n, Node *expected, Node *x) {
+    return next_[n].compare_exchange_strong(expected, x,
+                                            memory_order_acq_rel);
+  }
+
+ private:
+  /* 实际长度等于节点高度，多出来的部分紧跟在节点后面分配 */
+  std::atomic<Node *> next_[1];
+};
+
+template <typename K, class Comparator>
+SkipList<K, Comparator>::SkipList(Comparator cmp, Arena *arena)
+    : compare_(cmp),
+      arena_(arena),
+      head_(NewNode(K(), max_level_)),
+      max_height_(1) {
+  for (int i = 0; i < max_level_; i++) head_->SetNext(i, nullptr);
+}
+
+template <typename K, class Comparator>
+typename SkipList<K, Comparator>::Node *SkipList<K, Comparator>::NewNode(
+    const K &key, int height) {
+  char *mem = arena_->Allocate(sizeof(Node) +
+                               sizeof(std::atomic<Node *>) * (height - 1));
+  return new (mem) Node(key);
+}
+
+template <typename K, class Comparator>
+int SkipList<K, Comparator>::RandomHeight() {
+  /* 每个线程一个随机数生成器，避免插入时争用 */
+  thread_local minstd_rand rnd(random_device{}());
+  int height = 1;
+  while (height < max_level_ && rnd() % branching_ == 0) height++;
+  return height;
+}
+
+template <typename K, class Comparator>
+typename SkipList<K, Comparator>::Node *
+SkipList<K, Comparator>::FindGreaterOrEqual(const K &key) const {
+  Node *x = head_;
+  int level = GetMaxHeight() - 1;
+  while (true) {
+    Node *next = x->Next(level);
+    if (next != nullptr && compare_(next->key, key) < 0) {
+      x = next;
+    } else if (level == 0) {
+      return next;
+    } else {
+      level--;
+    }
+  }
+}
+
+template <typename K, class Comparator>
+typename SkipList<K, Comparator>::Node *SkipList<K, Comparator>::FindLessThan(
+    const K &key) const {
+  Node *x = head_;
+  int level = GetMaxHeight() - 1;
+  while (true) {
+    Node *next = x->Next(level);
+    if (next != nullptr && compare_(next->key, key) < 0) {
+      x = next;
+    } else if (level == 0) {
+      return x;
+    } else {
+      level--;
+    }
+  }
+}
+
+template <typename K, class Comparator>
+typename SkipList<K, Comparator>::Node *SkipList<K, Comparator>::FindLast()
+    const {
+  Node *x = head_;
+  int level = GetMaxHeight() - 1;
+  while (true) {
+    Node *next = x->Next(level);
+    if (next != nullptr) {
+      x = next;
+    } else if (level == 0) {
+      return x;
+    } else {
+      level--;
+    }
+  }
+}
+
+template <typename K, class Comparator>
+void SkipList<K, Comparator>::FindSpliceForLevel(const K &key, Node *before,
+                                                 int level, Node **out_prev,
+                                                 Node **out_next) const {
+  while (true) {
+    Node *next = before->Next(level);
+    if (next == nullptr || compare_(next->key, key) >= 0) {
+      *out_prev = before;
+      *out_next = next;
+      return;
+    }
+    before = next;
+  }
+}
+
+template <typename K, class Comparator>
+void SkipList<K, Comparator>::Insert(const K &key) {
+  Node *prev[max_level_];
+  Node *next[max_level_];
+  int height = RandomHeight();
+
+  /* 先抬高跳表高度，新的层上 head_ 的后继可能还是空的，不影响读者 */
+  int max_height = GetMaxHeight();
+  while (height > max_height) {
+    if (max_height_.compare_exchange_weak(max_height, height)) {
+      max_height = height;
+      break;
+    }
+  }
+
+  Node *before = head_;
+  for (int level = max_height - 1; level >= 0; level--) {
+    FindSpliceForLevel(key, before, level, &prev[level], &next[level]);
+    before = prev[level];
+  }
+  assert(next[0] == nullptr || compare_(next[0]->key, key) != 0);
+
+  Node *x = NewNode(key, height);
+  for (int level = 0; level < height; level++) {
+    while (true) {
+      x->NoBarrierSetNext(level, next[level]);
+      if (prev[level]->CASNext(level, next[level], x)) break;
+      /* 有其他线程插在了 prev 后面，重新找这一层的位置 */
+      FindSpliceForLevel(key, prev[level], level, &prev[level], &next[level]);
+    }
+  }
+}
+
+template <typename K, class Comparator>
+bool SkipList<K, Comparator>::Contains(const K &key) const {
+  Node *x = FindGreaterOrEqual(key);
+  return x != nullptr && compare_(key, x->key) == 0;
+}
+
+}  // namespace adl
+#endif  // ADL_LSM_TREE_SKIPLIST_H__
@@ -0,0 +1,30 @@
+#ifndef ADL_LSM_TREE_SNAPSHOT_H__
+#define ADL_LSM_TREE_SNAPSHOT_H__
+
+#include <cstdint>
+
+namespace adl {
+
+/**
+ * @brief 快照只记录创建时对读可见的最大序列号，不复制任何数据。
+ * 由 DB::GetSnapshot 创建，必须用 DB::ReleaseSnapshot 释放，
+ * 在释放之前压实会保留它能读到的版本。
+ */
+class Snapshot {
+ public:
+  Snapshot(const Snapshot &) = delete;
+  Snapshot &operator=(const Snapshot &) = delete;
+
+  int64_t GetSequence() const { return sequence_; }
+
+ private:
+  friend class DB;
+  explicit Snapshot(int64_t sequence) : sequence_(sequence) {}
+  ~Snapshot() = default;
+
+  const int64_t sequence_;
+};
+
+}  // namespace adl
+
+#endif  // ADL_LSM_TREE_SNAPSHOT_H__
@@ -4,6 +4,7 @@
 #include <sstream>
 #include "block.hpp"
 #include "db.hpp"
+#include "encode.hpp"
 #include "file_util.hpp"
 #include "hash_util.hpp"
 #include "keys.hpp"
@@ -18,7 +19,8 @@ SSTableWriter::SSTableWriter(string_view dbname, WritAbleFile *file,
     : dbname_(dbname),
       file_(file),
       offset_(0),
-      filter_block_(make_unique<BloomFilter>(options.bits_per_key)) {
+      filter_block_(NewFilterAlgorithm(options)),
+      partition_filters_(options.partition_filters) {
   SHA256_Init(&sha256_);
 }
 
@@ -46,6 +48,12 @@ RC SSTableWriter::FlushDataBlock() {
   /* add <K, {offset,size}> to index_block */
   string encoded_data_block_handle;
   data_block_handle_.EncodeMeta(encoded_data_block_handle);
+  if (partition_filters_) {
+    /* 这个数据块中的 key 生成一个过滤器，编号和数据块的顺序相同 */
+    int filter_num = filter_block_.FiltersCount();
+    filter_block_.Keys2Block();
+    encoded_data_block_handle.append((char *)&filter_num, sizeof(int));
+  }
   /* 最大key （目前不用 leveldb 那种优化） */
   index_block_.Add(last_key_, encoded_data_block_handle);
   return OK;
@@ -111,6 +119,84 @@ optional<unique_ptr<SSTableWriter>> NewSSTableWriter(string_view dbname,
   return make_unique<SSTableWriter>(dbname, temp_file, *options);
 }
 
+void SSTableReader::Iterator::Seek(string_view inner_key) {
+  auto idx_end = container_->index_block_reader_->end();
+  /* 索引项的 key 是数据块的最大 key，跳过的数据块不需要读取 */
+  while (*idx_iter_ != idx_end) {
+    if (!idx_iter_->Valid()) idx_iter_->Fetch();
+    if (CmpInnerKey(idx_iter_->Key(), inner_key) >= 0) break;
+    ++(*idx_iter_);
+  }
+  if (*idx_iter_ == idx_end) {
+    data_iter_ = nullopt;
+    return;
+  }
+  ResetDataIter();
+  /* 这个数据块中一定有大于等于 inner_key 的项 */
+  for (;;) {
+    if (!data_iter_->Valid()) data_iter_->Fetch();
+    if (CmpInnerKey(data_iter_->Key(), inner_key) >= 0) return;
+    ++(*this);
+  }
+}
+
+SSTableSplitWriter::SSTableSplitWriter(string_view dbname,
+                                       const DBOptions *options, int level,
+                                       int64_t run_id)
+    : dbname_(dbname),
+      options_(options),
+      level_(level),
+      run_id_(run_id),
+      meta_(nullptr) {}
+
+SSTableSplitWriter::~SSTableSplitWriter() {
+  /* 没有 Final 成功的文件元数据 */
+  delete meta_;
+  for (auto file : files_) delete file;
+}
+
+RC SSTableSplitWriter::Add(string_view inner_key, string_view value) {
+  RC rc = OK;
+  /* 当前文件已经足够大，并且换到了新的 user key */
+  if (writer_ && writer_->EstimatedSize() >= options_->target_file_size &&
+      CmpUserKeyOfInnerKey(last_key_, inner_key)) {
+    if (rc = FinishFile(); rc) return rc;
+  }
+  if (!writer_) {
+    auto sstable_ok = NewSSTableWriter(dbname_, options_);
+    if (!sstable_ok) return NEW_SSTABLE_ERROR;
+    writer_ = std::move(sstable_ok.value());
+    meta_ = new FileMetaData;
+    meta_->min_inner_key.FromKey(inner_key);
+  }
+  if (rc = writer_->Add(inner_key, value); rc) return rc;
+  meta_->max_seq = max(meta_->max_seq, InnerKeySeq(inner_key));
+  meta_->num_keys++;
+  last_key_ = inner_key;
+  return OK;
+}
+
+RC SSTableSplitWriter::FinishFile() {
+  if (auto rc = writer_->Final(meta_->sha256); rc) return rc;
+  meta_->file_size = writer_->GetFileSize();
+  meta_->max_inner_key.FromKey(last_key_);
+  meta_->belong_to_level = level_;
+  meta_->run_id = run_id_;
+  MLog->info("sstable {} created", sha256_digit_to_hex(meta_->sha256));
+  files_.push_back(meta_);
+  meta_ = nullptr;
+  writer_.reset();
+  return OK;
+}
+
+RC SSTableSplitWriter::Final(vector<FileMetaData *> &files) {
+  if (writer_)
+    if (auto rc = FinishFile(); rc) return rc;
+  files.insert(files.end(), files_.begin(), files_.end());
+  files_.clear();
+  return OK;
+}
+
 RC SSTableReader::ReadFooterBlock() {
   RC rc = OK;
   string_view footer_block_buffer;
@@ -234,8 +320,10 @@ RC SSTableReader::Get(string_view inner_key, string &key, string &value) {
   RC rc = OK;
   // MLog->trace("SSTableReader want Get key {}", key);
 
-  /* 布隆过滤器过滤 */
-  if (!filter_block_reader_.IsKeyExists(0, InnerKeyToUserKey(inner_key))) {
+  string_view user_key = InnerKeyToUserKey(inner_key);
+  /* 整个 sstable 一个过滤器时，在查索引之前过滤 */
+  if (!filter_block_reader_.IsPartitioned() &&
+      !filter_block_reader_.IsKeyExists(0, user_key)) {
     // MLog->error("filter_block_reader_ think key {} is not exists!", key);
     return NOT_FOUND;
   }
@@ -255,6 +343,14 @@ RC SSTableReader::Get(string_view inner_key, string &key, string &value) {
   BlockHandle data_block_handle;
 
   data_block_handle.DecodeFrom(data_block_handle_data);
+  /* 只检查索引指向的数据块对应的过滤器 */
+  if (filter_block_reader_.IsPartitioned()) {
+    int filter_num = 0;
+    if (data_block_handle_data.size() >= 3 * sizeof(int))
+      Decode32(data_block_handle_data.data() + 2 * sizeof(int), &filter_num);
+    if (!filter_block_reader_.IsKeyExists(filter_num, user_key))
+      return NOT_FOUND;
+  }
   MLog->info("Data Block Handle: off:{} size:{}",
              data_block_handle.block_offset_, data_block_handle.block_size_);
   shared_ptr<BlockReader> data_block_reader;
@@ -284,7 +380,8 @@ RC SSTableReader::GetBlockReader(BlockHandle &data_block_handle,
       return rc;
     }
     data_block_reader = make_shared<BlockReader>();
-    if (rc = data_block_reader->Init(data_block_buffer, CmpInnerKey,
+    /* sstable 被 table cache 淘汰后 mmap 就失效了，缓存的数据块需要拷贝一份 */
+    if (rc = data_block_reader->Init(string(data_block_buffer), CmpInnerKey,
                                      SaveResultIfUserKeyMatch);
         rc) {
       MLog->error("data_block_reader Init error: {}", strrc(rc));
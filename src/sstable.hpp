@@ -34,6 +34,9 @@ class SSTableWriter {
 
   string GetPath() { return file_->GetPath(); }
 
+  /* 已经写入的数据加上还在缓冲中的数据块大小 */
+  size_t EstimatedSize() { return offset_ + data_block_.EstimatedSize(); }
+
  private:
   RC FlushDataBlock();
 
@@ -52,6 +55,8 @@ class SSTableWriter {
   /* 过滤器块 */
   FilterBlockWriter filter_block_;
   BlockHandle filter_block_handle_;
+  /* 每个数据块一个过滤器，索引项的值后面追加过滤器的编号 */
+  bool partition_filters_;
 
   /* 元数据块 */
   BlockWriter meta_data_block_;
@@ -70,6 +75,37 @@ class SSTableWriter {
 optional<unique_ptr<SSTableWriter>> NewSSTableWriter(string_view dbname,
                                                      const DBOptions *options);
 
+/**
+ * @brief 按 DBOptions::target_file_size 将一个有序的输出切分成多个 sstable，
+ * 每个 sstable 对应一个 FileMetaData，同属于一个 run。
+ * 只在 user key 变化处切分，同一个 user key 的所有版本总在同一个文件中。
+ */
+class SSTableSplitWriter {
+ public:
+  SSTableSplitWriter(string_view dbname, const DBOptions *options, int level,
+                     int64_t run_id);
+  ~SSTableSplitWriter();
+  SSTableSplitWriter(const SSTableSplitWriter &) = delete;
+  SSTableSplitWriter &operator=(const SSTableSplitWriter &) = delete;
+
+  /* inner key 需要有序 */
+  RC Add(string_view inner_key, string_view value);
+  /* 完成最后一个文件，所有文件的元数据交给调用者 */
+  RC Final(vector<FileMetaData *> &files);
+
+ private:
+  RC FinishFile();
+
+  string dbname_;
+  const DBOptions *options_;
+  int level_;
+  int64_t run_id_;
+  unique_ptr<SSTableWriter> writer_;
+  FileMetaData *meta_; /* 正在写的文件 */
+  string last_key_;
+  vector<FileMetaData *> files_;
+};
+
 class DB;
 
 class SSTableReader : public enable_shared_from_this<SSTableReader> {
@@ -174,6 +210,9 @@ class SSTableReader : public enable_shared_from_this<SSTableReader> {
 
     Iterator GetContainerEnd() { return container_->end(); }
 
+    /* 定位到第一个大于等于 inner_key 的项，没有则等于 GetContainerEnd() */
+    void Seek(string_view inner_key);
+
    private:
     void ResetDataIter() {
       if (!idx_iter_) return;
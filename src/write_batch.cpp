@@ -0,0 +1,107 @@
+#include "write_batch.hpp"
+#include <string.h>
+#include "encode.hpp"
+
+namespace adl {
+
+WriteBatch::WriteBatch() { Clear(); }
+
+void WriteBatch::Clear() {
+  rep_.clear();
+  rep_.resize(header_size_);
+}
+
+void WriteBatch::Put(string_view key, string_view value) {
+  SetCount(Count() + 1);
+  rep_.push_back((char)OP_PUT);
+  EncodeWithPreLen(rep_, key);
+  EncodeWithPreLen(rep_, value);
+}
+
+void WriteBatch::Delete(string_view key) {
+  SetCount(Count() + 1);
+  rep_.push_back((char)OP_DELETE);
+  EncodeWithPreLen(rep_, key);
+  EncodeWithPreLen(rep_, "");
+}
+
+void WriteBatch::Append(const WriteBatch &batch) {
+  SetCount(Count() + batch.Count());
+  rep_.append(batch.rep_.data() + header_size_,
+              batch.rep_.size() - header_size_);
+}
+
+int WriteBatch::Count() const {
+  int count;
+  Decode32(rep_.data() + sizeof(int64_t), &count);
+  return count;
+}
+
+void WriteBatch::SetCount(int count) {
+  Encode32(count, &rep_[sizeof(int64_t)]);
+}
+
+int64_t WriteBatch::Sequence() const {
+  int64_t seq;
+  Decode64(rep_.data(), &seq);
+  return seq;
+}
+
+void WriteBatch::SetSequence(int64_t seq) { memcpy(&rep_[0], &seq, 8); }
+
+RC WriteBatch::SetData(string_view data) {
+  if (data.size() < header_size_) return BAD_RECORD;
+  int count;
+  Decode32(data.data() + sizeof(int64_t), &count);
+
+  /* 检查每一条记录都是完整的，保证 batch 要么整体回放要么整体丢弃 */
+  const char *cur = data.data() + header_size_;
+  const char *end = data.data() + data.size();
+  int found = 0;
+  while (cur < end) {
+    OpType op = (OpType)*cur;
+    if (op != OP_PUT && op != OP_DELETE) return BAD_RECORD;
+    cur += 1;
+    for (int i = 0; i < 2; i++) {
+      int len;
+      if (cur + sizeof(int) > end) return BAD_RECORD;
+      Decode32(cur, &len);
+      cur += sizeof(int);
+      if (len < 0 || cur + len > end) return BAD_RECORD;
+      cur += len;
+    }
+    found++;
+  }
+  if (found != count) return BAD_RECORD;
+
+  rep_.assign(data.data(), data.size());
+  return OK;
+}
+
+RC WriteBatch::ForEach(
+    const std::function<RC(const MemKey &key, string_view value)> &func)
+    const {
+  const char *cur = rep_.data() + header_size_;
+  const char *end = rep_.data() + rep_.size();
+  int64_t seq = Sequence();
+  MemKey memkey;
+
+  while (cur < end) {
+    int key_len;
+    int value_len;
+    memkey.op_type_ = (OpType)*cur;
+    cur += 1;
+    Decode32(cur, &key_len);
+    cur += sizeof(int);
+    memkey.user_key_.assign(cur, key_len);
+    cur += key_len;
+    Decode32(cur, &value_len);
+    cur += sizeof(int);
+    memkey.seq_ = seq++;
+    if (auto rc = func(memkey, {cur, (size_t)value_len}); rc) return rc;
+    cur += value_len;
+  }
+  return OK;
+}
+
+}  // namespace adl
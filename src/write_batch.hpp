@@ -0,0 +1,58 @@
+#ifndef ADL_LSM_TREE_WRITE_BATCH_H__
+#define ADL_LSM_TREE_WRITE_BATCH_H__
+
+#include <functional>
+#include <string>
+#include <string_view>
+#include "keys.hpp"
+#include "rc.hpp"
+
+namespace adl {
+
+using namespace std;
+
+/**
+ * @brief 原子写入的一批 put/delete
+  WriteBatch Format:
+
+  | seq 8Bytes | count 4Bytes | record | record | ... |
+
+  record:
+  | op 1Byte | key len 4Bytes | key | value len 4Bytes | value |
+
+  一个 batch 占用 [seq, seq + count) 这段连续的序列号，
+  它会作为一条记录写入 wal，并在一次加锁内写入 memtable。
+ */
+class WriteBatch {
+ public:
+  WriteBatch();
+  void Put(string_view key, string_view value);
+  void Delete(string_view key);
+  void Clear();
+  /* 将 batch 中的记录追加到当前 batch 的末尾，用于组提交 */
+  void Append(const WriteBatch &batch);
+
+  int Count() const;
+  int64_t Sequence() const;
+  void SetSequence(int64_t seq);
+  size_t ApproximateSize() const { return rep_.size(); }
+
+  /* 编码后的数据，直接作为 wal 记录 */
+  string_view Data() const { return rep_; }
+  /* 从 wal 记录中恢复，数据不完整时返回 BAD_RECORD */
+  RC SetData(string_view data);
+
+  /* 按写入顺序遍历每条记录，记录的 seq 从 Sequence() 开始递增 */
+  RC ForEach(
+      const std::function<RC(const MemKey &key, string_view value)> &func)
+      const;
+
+ private:
+  void SetCount(int count);
+
+  static constexpr size_t header_size_ = sizeof(int64_t) + sizeof(int);
+  string rep_;
+};
+
+}  // namespace adl
+#endif  // ADL_LSM_TREE_WRITE_BATCH_H__
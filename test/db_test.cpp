@@ -1,6 +1,7 @@
 #include "../src/db.hpp"
 #include <gtest/gtest.h>
 #include "../src/defer.hpp"
+#include "../src/revision.hpp"
 using namespace adl;
 
 TEST(db, test_db_create) {
@@ -586,6 +587,600 @@ TEST(db, test_compaction3) {
   ASSERT_EQ(db->Close(), OK);
 }
 
+TEST(db, test_group_commit) {
+  using namespace adl;
+  DB *db = nullptr;
+  DBOptions opts;
+  opts.sync = true;
+  opts.mem_table_max_size = 1UL << 16; /* 64KB */
+
+  string dbname = "/tmp/adl-testdb1";
+  opts.create_if_not_exists = true;
+  if (FileManager::Exists(dbname)) FileManager::Destroy(dbname);
+  ASSERT_EQ(DB::Open(dbname, opts, &db), OK);
+
+  defer _([&]() {
+    if (db) delete db;
+  });
+
+  /* 多个写者并发写入，由 leader 合并成组提交 */
+  vector<std::thread> writers;
+  for (int t = 0; t < 8; t++) {
+    writers.emplace_back([&, t]() {
+      for (int i = 0; i < 2000; i++) {
+        string key = fmt::format("key{}-{}", t, i);
+        string val = fmt::format("value{}-{}", t, i);
+        EXPECT_EQ(db->Put(key, val), OK) << "put error";
+      }
+    });
+  }
+  for (auto &writer : writers) writer.join();
+
+  ASSERT_EQ(db->Close(), OK);
+  delete db;
+
+  ASSERT_EQ(DB::Open(dbname, opts, &db), OK);
+  for (int t = 0; t < 8; t++) {
+    for (int i = 0; i < 2000; i++) {
+      string key = fmt::format("key{}-{}", t, i);
+      string val;
+      ASSERT_EQ(db->Get(key, val), OK) << "get error";
+      ASSERT_EQ(val, fmt::format("value{}-{}", t, i));
+    }
+  }
+  ASSERT_EQ(db->Close(), OK);
+}
+
+TEST(db, test_immutable_memtables) {
+  using namespace adl;
+  DB *db = nullptr;
+  DBOptions opts;
+  opts.mem_table_max_size = 1UL << 15; /* 32KB */
+  opts.max_immutable_memtables = 4;
+  opts.max_background_flushes = 4;
+  opts.level_files_limit = 100;
+
+  string dbname = "/tmp/adl-testdb1";
+  opts.create_if_not_exists = true;
+  if (FileManager::Exists(dbname)) FileManager::Destroy(dbname);
+  ASSERT_EQ(DB::Open(dbname, opts, &db), OK);
+
+  defer _([&]() {
+    if (db) delete db;
+  });
+
+  /* 多个 imm 并发落盘，写入的同时读取刚写入的数据 */
+  for (int i = 0; i < 20000; i++) {
+    string key = "key" + to_string(i);
+    ASSERT_EQ(db->Put(key, "value" + to_string(i)), OK) << "put error";
+    if (i % 97 == 0) {
+      string val;
+      ASSERT_EQ(db->Get(key, val), OK) << "get error";
+      ASSERT_EQ(val, "value" + to_string(i));
+    }
+  }
+  /* 覆盖写入，新值必须遮住已经落盘的旧值 */
+  for (int i = 0; i < 20000; i += 3)
+    ASSERT_EQ(db->Put("key" + to_string(i), "new" + to_string(i)), OK);
+
+  auto check = [&]() {
+    for (int i = 0; i < 20000; i++) {
+      string val;
+      ASSERT_EQ(db->Get("key" + to_string(i), val), OK) << "get error";
+      ASSERT_EQ(val, (i % 3 ? "value" : "new") + to_string(i));
+    }
+  };
+  check();
+
+  ASSERT_EQ(db->Close(), OK);
+  delete db;
+  db = nullptr;
+  ASSERT_EQ(DB::Open(dbname, opts, &db), OK);
+  check();
+  ASSERT_EQ(db->Close(), OK);
+}
+
+TEST(db, test_concurrent_get) {
+  using namespace adl;
+  DB *db = nullptr;
+  DBOptions opts;
+  opts.mem_table_max_size = 1UL << 15; /* 32KB */
+  opts.level_files_limit = 2;
+
+  string dbname = "/tmp/adl-testdb1";
+  opts.create_if_not_exists = true;
+  if (FileManager::Exists(dbname)) FileManager::Destroy(dbname);
+  ASSERT_EQ(DB::Open(dbname, opts, &db), OK);
+
+  defer _([&]() {
+    if (db) delete db;
+  });
+
+  /* 写入的同时触发落盘和压实，读者读到的已写入的 key 必须始终存在 */
+  const int n = 20000;
+  std::atomic<int> written(0);
+  std::thread writer([&]() {
+    for (int i = 0; i < n; i++) {
+      EXPECT_EQ(db->Put("key" + to_string(i), "value" + to_string(i)), OK);
+      written.store(i + 1, memory_order_release);
+    }
+  });
+  vector<std::thread> readers;
+  for (int t = 0; t < 4; t++) {
+    readers.emplace_back([&, t]() {
+      for (int round = 0; written.load(memory_order_acquire) < n; round++) {
+        int limit = written.load(memory_order_acquire);
+        if (!limit) continue;
+        int i = (round * 7919 + t) % limit;
+        string val;
+        ASSERT_EQ(db->Get("key" + to_string(i), val), OK) << "key" << i;
+        ASSERT_EQ(val, "value" + to_string(i));
+      }
+    });
+  }
+  writer.join();
+  for (auto &reader : readers) reader.join();
+  ASSERT_EQ(db->Close(), OK);
+}
+
+TEST(db, test_write_during_major_compaction) {
+  using namespace adl;
+  DB *db = nullptr;
+  DBOptions opts;
+  opts.mem_table_max_size = 1UL << 14; /* 16KB */
+  opts.level_files_limit = 2;
+  opts.max_background_flushes = 3;
+
+  string dbname = "/tmp/adl-testdb1";
+  opts.create_if_not_exists = true;
+  if (FileManager::Exists(dbname)) FileManager::Destroy(dbname);
+  ASSERT_EQ(DB::Open(dbname, opts, &db), OK);
+
+  defer _([&]() {
+    if (db) delete db;
+  });
+
+  /* 合并在锁外进行，期间新落盘的 L0 文件不能被当作输入移除 */
+  for (int round = 0; round < 4; round++) {
+    for (int i = 0; i < 5000; i++) {
+      string val = fmt::format("value{}-{}", round, i);
+      ASSERT_EQ(db->Put("key" + to_string(i), val), OK) << "put error";
+    }
+  }
+  auto check = [&]() {
+    for (int i = 0; i < 5000; i++) {
+      string val;
+      ASSERT_EQ(db->Get("key" + to_string(i), val), OK) << "key" << i;
+      ASSERT_EQ(val, fmt::format("value3-{}", i));
+    }
+  };
+  check();
+  ASSERT_EQ(db->Close(), OK);
+  delete db;
+  db = nullptr;
+  ASSERT_EQ(DB::Open(dbname, opts, &db), OK);
+  check();
+  ASSERT_EQ(db->Close(), OK);
+}
+
+TEST(db, test_leveling_compaction) {
+  using namespace adl;
+  DB *db = nullptr;
+  DBOptions opts;
+  opts.compaction_style = COMPACTION_LEVELING;
+  opts.mem_table_max_size = 1UL << 14; /* 16KB */
+  opts.level_files_limit = 2;
+  opts.level1_max_bytes = 1UL << 16; /* 64KB */
+  opts.level_size_multiplier = 4;
+  opts.target_file_size = 1UL << 13; /* 8KB，每次合并输出多个文件 */
+
+  string dbname = "/tmp/adl-testdb1";
+  opts.create_if_not_exists = true;
+  if (FileManager::Exists(dbname)) FileManager::Destroy(dbname);
+  ASSERT_EQ(DB::Open(dbname, opts, &db), OK);
+
+  defer _([&]() {
+    if (db) delete db;
+  });
+
+  /* 乱序写入多轮，每轮覆盖一部分 key，数据会被逐层合并下去 */
+  const int n = 10000;
+  vector<int> expect(n, -1);
+  for (int round = 0; round < 6; round++) {
+    for (int j = 0; j < n; j += round + 1) {
+      int i = (j * 7919) % n;
+      ASSERT_EQ(db->Put(fmt::format("key{:05d}", i),
+                        fmt::format("value{}-{}", round, i)),
+                OK);
+      expect[i] = round;
+    }
+  }
+  auto check = [&]() {
+    for (int i = 0; i < n; i++) {
+      string val;
+      ASSERT_EQ(db->Get(fmt::format("key{:05d}", i), val), OK) << "key" << i;
+      ASSERT_EQ(val, fmt::format("value{}-{}", expect[i], i));
+    }
+  };
+  check();
+  ASSERT_EQ(db->Close(), OK);
+  delete db;
+  db = nullptr;
+  ASSERT_EQ(DB::Open(dbname, opts, &db), OK);
+  check();
+  ASSERT_EQ(db->Close(), OK);
+}
+
+TEST(db, test_subcompactions) {
+  using namespace adl;
+  DB *db = nullptr;
+  DBOptions opts;
+  opts.mem_table_max_size = 1UL << 15;  /* 32KB */
+  opts.target_file_size = 1UL << 13;    /* 8KB */
+  opts.max_subcompactions = 4;
+
+  string dbname = "/tmp/adl-testdb1";
+  opts.create_if_not_exists = true;
+  if (FileManager::Exists(dbname)) FileManager::Destroy(dbname);
+  ASSERT_EQ(DB::Open(dbname, opts, &db), OK);
+
+  defer _([&]() {
+    if (db) delete db;
+  });
+
+  /* 乱序覆盖写入，每次合并都会按 key 范围拆成多个子任务 */
+  const int n = 10000;
+  for (int round = 0; round < 3; round++) {
+    for (int i = 0; i < n; i++) {
+      if (round == 2 && i % 3 == 0) continue;
+      string key = fmt::format("key{:05d}", (i * 7919) % n);
+      ASSERT_EQ(db->Put(key, fmt::format("value{}", round)), OK);
+    }
+  }
+  auto check = [&]() {
+    for (int i = 0; i < n; i++) {
+      string key = fmt::format("key{:05d}", (i * 7919) % n);
+      string val;
+      ASSERT_EQ(db->Get(key, val), OK) << key;
+      ASSERT_EQ(val, i % 3 == 0 ? "value1" : "value2") << key;
+    }
+  };
+  check();
+  ASSERT_EQ(db->Close(), OK);
+  delete db;
+  db = nullptr;
+  ASSERT_EQ(DB::Open(dbname, opts, &db), OK);
+  check();
+  ASSERT_EQ(db->Close(), OK);
+}
+
+TEST(db, test_background_pools) {
+  using namespace adl;
+  DB *db = nullptr;
+  DBOptions opts;
+  opts.compaction_style = COMPACTION_LEVELING;
+  opts.mem_table_max_size = 1UL << 14;  /* 16KB */
+  opts.target_file_size = 1UL << 13;    /* 8KB */
+  opts.level1_max_bytes = 1UL << 15;    /* 32KB */
+  opts.level_size_multiplier = 4;
+  opts.max_background_flushes = 2;
+  opts.max_background_compactions = 3;
+  opts.lower_compaction_cpu_priority = true;
+
+  string dbname = "/tmp/adl-testdb1";
+  opts.create_if_not_exists = true;
+  if (FileManager::Exists(dbname)) FileManager::Destroy(dbname);
+  ASSERT_EQ(DB::Open(dbname, opts, &db), OK);
+
+  defer _([&]() {
+    if (db) delete db;
+  });
+
+  /* 多层同时需要压实，不同层的压实可以在多个线程上并行 */
+  const int n = 8000;
+  for (int round = 0; round < 2; round++) {
+    for (int i = 0; i < n; i++) {
+      string key = fmt::format("key{:05d}", (i * 7919) % n);
+      ASSERT_EQ(db->Put(key, fmt::format("value{}-{}", round, i)), OK);
+    }
+  }
+  auto check = [&]() {
+    for (int i = 0; i < n; i++) {
+      string key = fmt::format("key{:05d}", (i * 7919) % n);
+      string val;
+      ASSERT_EQ(db->Get(key, val), OK) << key;
+      ASSERT_EQ(val, fmt::format("value1-{}", i)) << key;
+    }
+  };
+  check();
+  ASSERT_EQ(db->Close(), OK);
+  delete db;
+  db = nullptr;
+  ASSERT_EQ(DB::Open(dbname, opts, &db), OK);
+  check();
+  ASSERT_EQ(db->Close(), OK);
+}
+
+TEST(db, test_trivial_move) {
+  using namespace adl;
+  DBOptions opts;
+  opts.compaction_style = COMPACTION_LEVELING;
+  opts.mem_table_max_size = 1UL << 14; /* 16KB */
+  opts.level_files_limit = 2;
+  opts.level1_max_bytes = 1UL << 15; /* 32KB */
+  opts.level_size_multiplier = 4;
+  opts.target_file_size = 1UL << 13; /* 8KB */
+  opts.create_if_not_exists = true;
+
+  /* 写入 n 个 key 后返回 sstable 目录中的文件数，旧文件不会被删除，
+   * 所以文件数就是落盘和压实一共写出的文件数 */
+  const int n = 20000;
+  auto run = [&](string dbname, bool sequential) -> size_t {
+    DB *db = nullptr;
+    if (FileManager::Exists(dbname)) FileManager::Destroy(dbname);
+    EXPECT_EQ(DB::Open(dbname, opts, &db), OK);
+    defer _([&]() { delete db; });
+    auto key_of = [&](int i) {
+      return fmt::format("key{:05d}", sequential ? i : (i * 7919) % n);
+    };
+    for (int i = 0; i < n; i++)
+      EXPECT_EQ(db->Put(key_of(i), fmt::format("value{}", i)), OK);
+    for (int i = 0; i < n; i++) {
+      string val;
+      EXPECT_EQ(db->Get(key_of(i), val), OK) << key_of(i);
+      EXPECT_EQ(val, fmt::format("value{}", i));
+    }
+    EXPECT_EQ(db->Close(), OK);
+    vector<string> ssts;
+    EXPECT_EQ(FileManager::ReadDir(SstDir(dbname), ssts), OK);
+    return ssts.size();
+  };
+
+  /* 顺序写入时文件只会被移动到下一层，不会被重写 */
+  size_t sequential_files = run("/tmp/adl-testdb1", true);
+  size_t random_files = run("/tmp/adl-testdb2", false);
+  ASSERT_LT(sequential_files * 2, random_files);
+}
+
+TEST(db, test_delete_compaction) {
+  using namespace adl;
+  for (auto style : {COMPACTION_TIERING, COMPACTION_LEVELING}) {
+    DB *db = nullptr;
+    DBOptions opts;
+    opts.compaction_style = style;
+    opts.mem_table_max_size = 1UL << 14; /* 16KB */
+    opts.level_files_limit = 2;
+    opts.level1_max_bytes = 1UL << 15; /* 32KB */
+    opts.level_size_multiplier = 4;
+    opts.target_file_size = 1UL << 13; /* 8KB */
+
+    string dbname = "/tmp/adl-testdb1";
+    opts.create_if_not_exists = true;
+    if (FileManager::Exists(dbname)) FileManager::Destroy(dbname);
+    ASSERT_EQ(DB::Open(dbname, opts, &db), OK);
+
+    defer _([&]() {
+      if (db) delete db;
+    });
+
+    /* 删除标记和被删除的数据常常在不同的层或 run 中，
+     * 删除标记必须遮住更旧的数据，压实丢弃它们后也不能让旧数据重新出现 */
+    const int n = 6000;
+    auto key_of = [&](int i) {
+      return fmt::format("key{:05d}", (i * 7919) % n);
+    };
+    for (int round = 0; round < 3; round++) {
+      for (int i = 0; i < n; i++)
+        ASSERT_EQ(db->Put(key_of(i), fmt::format("value{}-{}", round, i)),
+                  OK);
+      for (int i = 0; i < n; i++)
+        if (i % 10) ASSERT_EQ(db->Delete(key_of(i)), OK);
+    }
+    auto check = [&]() {
+      for (int i = 0; i < n; i++) {
+        string val;
+        RC rc = db->Get(key_of(i), val);
+        if (i % 10) {
+          ASSERT_EQ(rc, NOT_FOUND) << style << " " << key_of(i);
+          continue;
+        }
+        ASSERT_EQ(rc, OK) << style << " " << key_of(i);
+        ASSERT_EQ(val, fmt::format("value2-{}", i));
+      }
+    };
+    check();
+    ASSERT_EQ(db->Close(), OK);
+    delete db;
+    db = nullptr;
+    ASSERT_EQ(DB::Open(dbname, opts, &db), OK);
+    check();
+    ASSERT_EQ(db->Close(), OK);
+  }
+}
+
+TEST(db, test_snapshot) {
+  using namespace adl;
+  for (auto style : {COMPACTION_TIERING, COMPACTION_LEVELING}) {
+    DB *db = nullptr;
+    DBOptions opts;
+    opts.compaction_style = style;
+    opts.mem_table_max_size = 1UL << 14; /* 16KB */
+    opts.level_files_limit = 2;
+    opts.level1_max_bytes = 1UL << 15; /* 32KB */
+    opts.level_size_multiplier = 4;
+    opts.target_file_size = 1UL << 13; /* 8KB */
+
+    string dbname = "/tmp/adl-testdb1";
+    opts.create_if_not_exists = true;
+    if (FileManager::Exists(dbname)) FileManager::Destroy(dbname);
+    ASSERT_EQ(DB::Open(dbname, opts, &db), OK);
+
+    defer _([&]() {
+      if (db) delete db;
+    });
+
+    const int n = 4000;
+    auto key_of = [&](int i) {
+      return fmt::format("key{:05d}", (i * 7919) % n);
+    };
+    for (int i = 0; i < n; i++)
+      ASSERT_EQ(db->Put(key_of(i), fmt::format("old{}", i)), OK);
+    const Snapshot *snapshot = db->GetSnapshot();
+
+    /* 快照之后的覆盖和删除会经过多轮落盘和压实 */
+    for (int round = 0; round < 3; round++) {
+      for (int i = 0; i < n; i++) {
+        if (i % 5 == 0)
+          ASSERT_EQ(db->Delete(key_of(i)), OK);
+        else
+          ASSERT_EQ(db->Put(key_of(i), fmt::format("new{}-{}", round, i)), OK);
+      }
+    }
+    ASSERT_EQ(db->Put("key-after", "value"), OK);
+
+    ReadOptions read_options;
+    read_options.snapshot = snapshot;
+    for (int i = 0; i < n; i++) {
+      string val;
+      ASSERT_EQ(db->Get(read_options, key_of(i), val), OK)
+          << style << " " << key_of(i);
+      ASSERT_EQ(val, fmt::format("old{}", i));
+      RC rc = db->Get(key_of(i), val);
+      if (i % 5 == 0) {
+        ASSERT_EQ(rc, NOT_FOUND) << style << " " << key_of(i);
+      } else {
+        ASSERT_EQ(rc, OK) << style << " " << key_of(i);
+        ASSERT_EQ(val, fmt::format("new2-{}", i));
+      }
+    }
+    string val;
+    ASSERT_EQ(db->Get(read_options, "key-after", val), NOT_FOUND);
+    ASSERT_EQ(db->Get("key-after", val), OK);
+    db->ReleaseSnapshot(snapshot);
+    ASSERT_EQ(db->Close(), OK);
+  }
+}
+
+TEST(db, test_level_disjoint) {
+  using namespace adl;
+  Level level(nullptr, 1);
+  auto new_file = [](string_view min_key, string_view max_key) {
+    FileMetaData *file_meta = new FileMetaData;
+    file_meta->min_inner_key = MemKey(min_key, 2);
+    file_meta->max_inner_key = MemKey(max_key, 1);
+    return file_meta;
+  };
+  /* 乱序插入，数组仍然按 min key 排列 */
+  level.Insert(new_file("k50", "k59"));
+  level.Insert(new_file("k10", "k19"));
+  level.Insert(new_file("k30", "k39"));
+  ASSERT_TRUE(level.IsDisjoint());
+
+  /* 与两侧的文件都重叠 */
+  FileMetaData *overlapped = new_file("k15", "k35");
+  level.Insert(overlapped);
+  ASSERT_FALSE(level.IsDisjoint());
+  level.Erase(overlapped);
+  ASSERT_TRUE(level.IsDisjoint());
+
+  /* 相邻文件的边界 user key 相同也算重叠 */
+  FileMetaData *touched = new_file("k39", "k45");
+  level.Insert(touched);
+  ASSERT_FALSE(level.IsDisjoint());
+  Level copied(level);
+  ASSERT_FALSE(copied.IsDisjoint());
+  level.Erase(touched);
+  ASSERT_TRUE(level.IsDisjoint());
+  ASSERT_EQ(level.FilesCount(), 3);
+}
+
+TEST(db, test_tiering_newest_version) {
+  using namespace adl;
+  DB *db = nullptr;
+  DBOptions opts;
+  opts.compaction_style = COMPACTION_TIERING;
+  opts.mem_table_max_size = 1UL << 14; /* 16KB */
+  /* 每层保留较多的 run，同一个 key 的多个版本分布在重叠的 run 中 */
+  opts.level_files_limit = 8;
+  opts.target_file_size = 1UL << 13; /* 8KB */
+
+  string dbname = "/tmp/adl-testdb1";
+  opts.create_if_not_exists = true;
+  if (FileManager::Exists(dbname)) FileManager::Destroy(dbname);
+  ASSERT_EQ(DB::Open(dbname, opts, &db), OK);
+
+  defer _([&]() {
+    if (db) delete db;
+  });
+
+  const int n = 4000;
+  const int rounds = 6;
+  for (int round = 0; round < rounds; round++) {
+    for (int i = 0; i < n; i++) {
+      /* 只有部分 key 在之后的轮次中被覆盖，旧版本留在更早的 run 里 */
+      if (round > 0 && i % (round + 1)) continue;
+      ASSERT_EQ(db->Put(fmt::format("key{:05d}", i),
+                        fmt::format("value{}-{}", round, i)),
+                OK);
+    }
+  }
+  for (int i = 0; i < n; i++) {
+    int last = 0;
+    for (int round = 1; round < rounds; round++)
+      if (i % (round + 1) == 0) last = round;
+    string val;
+    ASSERT_EQ(db->Get(fmt::format("key{:05d}", i), val), OK);
+    ASSERT_EQ(val, fmt::format("value{}-{}", last, i));
+  }
+  ASSERT_EQ(db->Close(), OK);
+}
+
+TEST(db, test_write_batch) {
+  using namespace adl;
+  DB *db = nullptr;
+  DBOptions opts;
+  string dbname = "/tmp/adl-testdb1";
+  opts.create_if_not_exists = true;
+  if (FileManager::Exists(dbname)) FileManager::Destroy(dbname);
+  ASSERT_EQ(DB::Open(dbname, opts, &db), OK);
+
+  defer _([&]() {
+    if (db) delete db;
+  });
+
+  WriteBatch batch;
+  for (int i = 0; i < 1000; i++)
+    batch.Put("key" + to_string(i), "value" + to_string(i));
+  for (int i = 0; i < 1000; i += 2) batch.Delete("key" + to_string(i));
+  batch.Put("key0", "value-new");
+  ASSERT_EQ(batch.Count(), 1501);
+  ASSERT_EQ(db->Write(batch), OK);
+
+  auto check = [&]() {
+    string val;
+    ASSERT_EQ(db->Get("key0", val), OK);
+    ASSERT_EQ(val, "value-new");
+    for (int i = 1; i < 1000; i++) {
+      string key = "key" + to_string(i);
+      auto rc = db->Get(key, val);
+      if (i % 2) {
+        ASSERT_EQ(rc, OK) << "get error";
+        ASSERT_EQ(val, "value" + to_string(i));
+      } else {
+        ASSERT_EQ(rc, NOT_FOUND) << "get " << val << " is bug";
+      }
+    }
+  };
+  check();
+
+  /* 重新打开，从 wal 中整体回放 batch */
+  ASSERT_EQ(db->Close(), OK);
+  delete db;
+  ASSERT_EQ(DB::Open(dbname, opts, &db), OK);
+  check();
+  ASSERT_EQ(db->Close(), OK);
+}
+
 TEST(db, test_debug_sstable) {
   using namespace adl;
   DB *db = nullptr;
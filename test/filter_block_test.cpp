@@ -50,4 +50,26 @@ TEST(filter_block, bloom_filter) {
   EXPECT_TRUE(fbr.IsKeyExists(1, "dont"));
   EXPECT_TRUE(fbr.IsKeyExists(1, "like-apple"));
   EXPECT_FALSE(fbr.IsKeyExists(1, "dont like-apple"));
-}
\ No newline at end of file
+}
+TEST(filter_block, blocked_bloom_filter) {
+  using namespace adl;
+  string result;
+  FilterBlockWriter filter(make_unique<BlockedBloomFilter>(10));
+  for (int i = 0; i < 10000; i++) filter.Update("hello-ddl" + to_string(i));
+  filter.Keys2Block();
+  filter.Update("adl");
+  filter.Keys2Block();
+  filter.Final(result);
+
+  FilterBlockReader fbr;
+  ASSERT_EQ(fbr.Init(result), OK);
+  for (int i = 0; i < 10000; i++)
+    EXPECT_TRUE(fbr.IsKeyExists(0, "hello-ddl" + to_string(i)));
+  EXPECT_TRUE(fbr.IsKeyExists(1, "adl"));
+
+  /* 10 bits per key 时误判率应在 1% 左右 */
+  int false_positives = 0;
+  for (int i = 0; i < 10000; i++)
+    if (fbr.IsKeyExists(0, "not-exists" + to_string(i))) false_positives++;
+  EXPECT_LT(false_positives, 300);
+}
@@ -1,6 +1,9 @@
 #include "../src/mem_table.hpp"
 #include <gtest/gtest.h>
+#include <thread>
+#include <vector>
 #include "../src/options.hpp"
+#include "../src/skiplist.hpp"
 
 TEST(mem_table_test, PutAndGet1) {
   using namespace adl;
@@ -97,4 +100,101 @@ TEST(mem_table_test, PutAndGetBig) {
     ASSERT_EQ(table.Get(key, val), OK) << "get error";
     ASSERT_EQ(val, "value" + to_string(i));
   }
-}
\ No newline at end of file
+}
+
+TEST(mem_table_test, SkipListOrder) {
+  using namespace adl;
+  struct IntCmp {
+    int operator()(int a, int b) const { return a < b ? -1 : a > b; }
+  };
+  Arena arena;
+  SkipList<int, IntCmp> list(IntCmp(), &arena);
+  for (int i = 0; i < 1000; i++) list.Insert((i * 7919) % 1000);
+
+  SkipList<int, IntCmp>::Iterator iter(&list);
+  int expect = 0;
+  for (iter.SeekToFirst(); iter.Valid(); iter.Next())
+    ASSERT_EQ(iter.Key(), expect++);
+  ASSERT_EQ(expect, 1000);
+  iter.Seek(500);
+  ASSERT_TRUE(iter.Valid());
+  ASSERT_EQ(iter.Key(), 500);
+  iter.Prev();
+  ASSERT_EQ(iter.Key(), 499);
+  iter.SeekToLast();
+  ASSERT_EQ(iter.Key(), 999);
+  ASSERT_FALSE(list.Contains(1000));
+}
+
+TEST(mem_table_test, ConcurrentPut) {
+  using namespace adl;
+  DBOptions opts;
+  MemTable table(opts);
+  const int threads_num = 8;
+  const int per_thread = 5000;
+  vector<thread> threads;
+  for (int t = 0; t < threads_num; t++) {
+    threads.emplace_back([&, t] {
+      for (int i = 0; i < per_thread; i++) {
+        int n = i * threads_num + t;
+        MemKey key("key" + to_string(n), n, OP_PUT);
+        table.Put(key, "value" + to_string(n));
+      }
+    });
+  }
+  for (auto &t : threads) t.join();
+
+  string val;
+  for (int n = 0; n < threads_num * per_thread; n++) {
+    ASSERT_EQ(table.Get("key" + to_string(n), val), OK) << "get error";
+    ASSERT_EQ(val, "value" + to_string(n));
+  }
+  /* 遍历结果必须严格有序 */
+  int count = 0;
+  MemKey last;
+  table.ForEachNoLock([&](const MemKey &key, string_view value) -> RC {
+    if (count++) EXPECT_TRUE(last < key);
+    last = key;
+    return OK;
+  });
+  ASSERT_EQ(count, threads_num * per_thread);
+}
+
+TEST(mem_table_test, RepTypes) {
+  using namespace adl;
+  for (auto rep : {SKIPLIST_REP, HASH_SKIPLIST_REP, VECTOR_REP}) {
+    DBOptions opts;
+    opts.mem_table_rep = rep;
+    opts.hash_prefix_len = 4;
+    MemTable table(opts);
+    /* 倒序写入，再写入一批更新和删除 */
+    for (int i = 999; i >= 0; i--)
+      table.Put(MemKey("key" + to_string(i), 999 - i, OP_PUT),
+                "value" + to_string(i));
+    for (int i = 0; i < 1000; i += 2) {
+      OpType op = i % 4 ? OP_DELETE : OP_PUT;
+      table.Put(MemKey("key" + to_string(i), 1000 + i, op), "new");
+    }
+
+    string val;
+    for (int i = 0; i < 1000; i++) {
+      RC rc = table.Get("key" + to_string(i), val);
+      if (i % 4 == 2) {
+        ASSERT_EQ(rc, NOT_FOUND) << "rep " << rep << " key" << i;
+        continue;
+      }
+      ASSERT_EQ(rc, OK) << "rep " << rep << " key" << i;
+      ASSERT_EQ(val, i % 4 ? "value" + to_string(i) : "new");
+    }
+    ASSERT_EQ(table.Get("nokey", val), NOT_FOUND);
+
+    int count = 0;
+    MemKey last;
+    table.ForEachNoLock([&](const MemKey &key, string_view value) -> RC {
+      if (count++) EXPECT_TRUE(last < key) << "rep " << rep;
+      last = key;
+      return OK;
+    });
+    ASSERT_EQ(count, 1500);
+  }
+}
@@ -22,7 +22,10 @@ void BuildSSTable(string_view dbname, adl::FileMetaData **meta_data_pointer) {
   ASSERT_EQ(FileManager::Create(dbname, DIR_), OK);
   ASSERT_EQ(FileManager::Create(SstDir(dbname), DIR_), OK);
 
-  ASSERT_EQ(table.BuildSSTable(dbname, meta_data_pointer), OK);
+  vector<FileMetaData *> files;
+  ASSERT_EQ(table.BuildSSTable(dbname, 1, files), OK);
+  ASSERT_EQ(files.size(), 1);
+  *meta_data_pointer = files.front();
   ASSERT_NE(meta_data_pointer, nullptr);
 }
 
@@ -41,7 +44,10 @@ void BuildSSTable2(string_view dbname, adl::FileMetaData **meta_data_pointer) {
   if (FileManager::Exists(dbname)) ASSERT_EQ(FileManager::Destroy(dbname), OK);
   ASSERT_EQ(FileManager::Create(dbname, DIR_), OK);
   ASSERT_EQ(FileManager::Create(SstDir(dbname), DIR_), OK);
-  ASSERT_EQ(table.BuildSSTable(dbname, meta_data_pointer), OK);
+  vector<FileMetaData *> files;
+  ASSERT_EQ(table.BuildSSTable(dbname, 1, files), OK);
+  ASSERT_EQ(files.size(), 1);
+  *meta_data_pointer = files.front();
 }
 
 void BuildSSTable3(string_view dbname, adl::FileMetaData **meta_data_pointer) {
@@ -67,7 +73,10 @@ void BuildSSTable3(string_view dbname, adl::FileMetaData **meta_data_pointer) {
   if (FileManager::Exists(dbname)) ASSERT_EQ(FileManager::Destroy(dbname), OK);
   ASSERT_EQ(FileManager::Create(dbname, DIR_), OK);
   ASSERT_EQ(FileManager::Create(SstDir(dbname), DIR_), OK);
-  ASSERT_EQ(table.BuildSSTable(dbname, meta_data_pointer), OK);
+  vector<FileMetaData *> files;
+  ASSERT_EQ(table.BuildSSTable(dbname, 1, files), OK);
+  ASSERT_EQ(files.size(), 1);
+  *meta_data_pointer = files.front();
 }
 
 void BuildSSTable4(string_view dbname, adl::FileMetaData **meta_data_pointer) {
@@ -86,7 +95,10 @@ void BuildSSTable4(string_view dbname, adl::FileMetaData **meta_data_pointer) {
   if (FileManager::Exists(dbname)) ASSERT_EQ(FileManager::Destroy(dbname), OK);
   ASSERT_EQ(FileManager::Create(dbname, DIR_), OK);
   ASSERT_EQ(FileManager::Create(SstDir(dbname), DIR_), OK);
-  ASSERT_EQ(table.BuildSSTable(dbname, meta_data_pointer), OK);
+  vector<FileMetaData *> files;
+  ASSERT_EQ(table.BuildSSTable(dbname, 1, files), OK);
+  ASSERT_EQ(files.size(), 1);
+  *meta_data_pointer = files.front();
 }
 
 TEST(sstable, memtable_to_sstable) {
@@ -259,3 +271,91 @@ TEST(sstable, Iterator) {
 
   delete sstable_meta;
 }
+
+TEST(sstable, split_by_target_file_size) {
+  using namespace adl;
+  auto dbname = "/tmp/splitdb";
+  DBOptions opts;
+  opts.target_file_size = 1UL << 14; /* 16KB */
+  MemTable table(opts);
+  /* 每个 key 有多个版本，切分时不能把它们分到两个文件中 */
+  int seq = 0;
+  for (int i = 0; i < 2000; i++) {
+    string key = fmt::format("key{:05d}", i);
+    for (int j = 0; j < 3; j++) {
+      MemKey memkey(key, seq++, OP_PUT);
+      ASSERT_EQ(table.Put(memkey, "value" + to_string(j)), OK);
+    }
+  }
+  if (FileManager::Exists(dbname)) ASSERT_EQ(FileManager::Destroy(dbname), OK);
+  ASSERT_EQ(FileManager::Create(dbname, DIR_), OK);
+  ASSERT_EQ(FileManager::Create(SstDir(dbname), DIR_), OK);
+
+  vector<FileMetaData *> files;
+  ASSERT_EQ(table.BuildSSTable(dbname, 7, files), OK);
+  ASSERT_GT(files.size(), 1);
+
+  int num_keys = 0;
+  for (size_t i = 0; i < files.size(); i++) {
+    EXPECT_EQ(files[i]->run_id, 7);
+    EXPECT_EQ(files[i]->belong_to_level, 0);
+    EXPECT_EQ(files[i]->num_keys % 3, 0);
+    if (i > 0)
+      EXPECT_LT(files[i - 1]->max_inner_key.user_key_,
+                files[i]->min_inner_key.user_key_);
+    num_keys += files[i]->num_keys;
+  }
+  EXPECT_EQ(num_keys, 6000);
+  for (auto file : files) delete file;
+}
+
+TEST(sstable, partition_filters) {
+  using namespace adl;
+  auto dbname = "/tmp/partitiondb";
+  DBOptions opts;
+  opts.partition_filters = true;
+  MemTable table(opts);
+  /* 同一个 key 的多个版本可能跨过数据块的边界，两个数据块的过滤器中都要有它 */
+  int seq = 0;
+  for (int i = 0; i < 3000; i++) {
+    string key = fmt::format("key{:05d}", i);
+    for (int j = 0; j < 3; j++) {
+      MemKey memkey(key, seq++, OP_PUT);
+      ASSERT_EQ(table.Put(memkey, "value" + to_string(j)), OK);
+    }
+  }
+  if (FileManager::Exists(dbname)) ASSERT_EQ(FileManager::Destroy(dbname), OK);
+  ASSERT_EQ(FileManager::Create(dbname, DIR_), OK);
+  ASSERT_EQ(FileManager::Create(SstDir(dbname), DIR_), OK);
+
+  vector<FileMetaData *> files;
+  ASSERT_EQ(table.BuildSSTable(dbname, 1, files), OK);
+  ASSERT_EQ(files.size(), 1);
+  FileMetaData *sstable_meta = files.front();
+
+  SSTableReader *sstable;
+  MmapReadAbleFile *file;
+  string oid = sha256_digit_to_hex(sstable_meta->sha256);
+  ASSERT_EQ(FileManager::OpenMmapReadAbleFile(
+                sstable_meta->GetSSTablePath(dbname), &file),
+            OK);
+  ASSERT_EQ(SSTableReader::Open(file, &sstable, oid), OK);
+  for (int i = 0; i < 3000; i++) {
+    string key = fmt::format("key{:05d}", i);
+    string val, _;
+    /* 最新的版本和最旧的版本 */
+    ASSERT_EQ(sstable->Get(NewMinInnerKey(key), _, val), OK) << key;
+    EXPECT_EQ(val, "value2");
+    ASSERT_EQ(
+        sstable->Get(MemKey::NewLookupKey(key, i * 3).ToKey(), _, val), OK)
+        << key;
+    EXPECT_EQ(val, "value0");
+  }
+  for (int i = 0; i < 3000; i++) {
+    string key = fmt::format("key{:05d}x", i);
+    string val, _;
+    EXPECT_EQ(sstable->Get(NewMinInnerKey(key), _, val), NOT_FOUND) << key;
+  }
+  delete sstable_meta;
+  delete sstable;
+}
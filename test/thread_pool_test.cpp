@@ -0,0 +1,47 @@
+#include "../src/back_ground_worker.hpp"
+#include <gtest/gtest.h>
+
+using namespace adl;
+using namespace std;
+
+TEST(thread_pool, run_all_tasks) {
+  std::atomic<int> count(0);
+  {
+    ThreadPool pool(4);
+    for (int i = 0; i < 1000; i++) pool.Add([&]() { count++; });
+    vector<function<void()>> tasks;
+    for (int i = 0; i < 100; i++) tasks.push_back([&]() { count++; });
+    pool.RunAndWait(std::move(tasks));
+    while (count < 1100) std::this_thread::yield();
+  }
+  EXPECT_EQ(count, 1100);
+}
+
+/* 池内任务再提交子任务并等待，只有一个线程时等待者自己执行子任务 */
+TEST(thread_pool, nested_run_and_wait) {
+  ThreadPool pool(1);
+  std::atomic<int> count(0);
+  std::atomic<bool> done(false);
+  pool.Add([&]() {
+    vector<function<void()>> tasks;
+    for (int i = 0; i < 16; i++) tasks.push_back([&]() { count++; });
+    pool.RunAndWait(std::move(tasks));
+    done = true;
+  });
+  while (!done) std::this_thread::yield();
+  EXPECT_EQ(count, 16);
+}
+
+/* 一个线程被长任务占住时，其它线程会窃取它队列中的任务 */
+TEST(thread_pool, steal_tasks) {
+  ThreadPool pool(2);
+  std::atomic<bool> release(false);
+  std::atomic<int> count(0);
+  pool.Add([&]() {
+    for (int i = 0; i < 8; i++) pool.Add([&]() { count++; });
+    while (!release) std::this_thread::yield();
+  });
+  while (count < 8) std::this_thread::yield();
+  release = true;
+  EXPECT_EQ(count, 8);
+}